@@ -11,8 +11,11 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <ccan/htable/htable.h>
@@ -24,6 +27,7 @@
 #include <ccan/darray/darray.h>
 
 #include "pht.h"
+#include "pht_sharded.h"
 
 
 struct ht_ops {
@@ -35,6 +39,12 @@ struct ht_ops {
 	bool (*del)(void *ht, size_t hash, const void *key);
 	void *(*firstval)(const void *, void *, size_t);
 	void *(*nextval)(const void *, void *, size_t);
+	/* replaces firstval, nextval, and the cmp callback when not NULL. */
+	void *(*get)(const void *ht, size_t hash, const void *key);
+	size_t (*ntables)(const void *ht);	/* NULL if not applicable */
+	/* when init is NULL, pht_init_opts() with these. */
+	unsigned flags;
+	bool mt;	/* add, del safe to call from several threads at once */
 };
 
 
@@ -43,6 +53,7 @@ struct bmctx {
 	const struct ht_ops *ops;
 	const char *wordbuf;
 	size_t n_words;
+	int threads;
 	char name[40];
 };
 
@@ -51,9 +62,14 @@ struct benchmark {
 	const char *name;
 	void (*run)(struct bmctx *ctx, int writefd);
 	void (*report)(struct bmctx *ctx, int readfd);
+	bool mt;	/* run with 1..MAX_THREADS threads, for ht_ops.mt only */
+	bool ntables;	/* for ht_ops.ntables only */
 };
 
 
+#define MAX_THREADS 64
+
+
 static size_t n_cmp_str = 0;
 
 
@@ -84,11 +100,88 @@ static bool cmp_str(const void *cand, void *key) {
 }
 
 
+/* tables of 2M and up from anonymous mmap(), advised into transparent huge
+ * pages, and smaller ones from posix_memalign().
+ */
+#define HUGE_SIZE ((size_t)2 << 20)
+
+static void *huge_alloc_zeroed(size_t size, void *priv)
+{
+	if(size < HUGE_SIZE) {
+		void *p;
+		return posix_memalign(&p, 64, size) == 0 ? memset(p, 0, size) : NULL;
+	}
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) return NULL;
+	madvise(p, size, MADV_HUGEPAGE);
+	return p;
+}
+
+
+static void huge_free(void *ptr, size_t size, void *priv)
+{
+	if(size < HUGE_SIZE) free(ptr);
+	else munmap(ptr, size);
+}
+
+
+static void pht_huge_init(void *ht,
+	size_t (*rehash)(const void *, void *), void *priv)
+{
+	static const struct pht_alloc huge = {
+		.alloc_zeroed = &huge_alloc_zeroed, .free = &huge_free,
+	};
+	pht_init_opts(ht, rehash, priv, &(struct pht_opts){ .alloc = &huge });
+}
+
+
+/* the same as "pht", but looked up through PHT_DEFINE_TYPE() wrappers. */
+static inline const char *word_key(const char *word) {
+	return word;
+}
+
+
+static inline size_t word_hash(const char *word) {
+	return rehash_str(word, NULL);
+}
+
+
+static inline bool word_eq(const char *cand, const char *key) {
+	n_cmp_str++;
+	return streq(cand, key);
+}
+
+
+PHT_DEFINE_TYPE(char, word_key, word_hash, word_eq, pht_words);
+
+
+static void pht_typed_init(void *ht,
+	size_t (*rehash)(const void *, void *), void *priv)
+{
+	pht_words_init(ht);
+}
+
+
+static void *pht_typed_get(const void *ht, size_t hash, const void *key) {
+	return pht_words_gethash(ht, hash, key);
+}
+
+
+/* enough shards that MAX_THREADS writers rarely meet. */
+static void sharded_init(void *sh,
+	size_t (*rehash)(const void *, void *), void *priv)
+{
+	if(!pht_sharded_init(sh, 8, rehash, priv)) abort();
+}
+
+
 static inline void *ht_ops_get(
 	const struct ht_ops *ops, void *ht,
 	void *iter, size_t hash,
 	bool (*cmpfn)(const void *cand, void *key), const void *key)
 {
+	if(ops->get != NULL) return (*ops->get)(ht, hash, key);
 	for(void *cand = (*ops->firstval)(ht, iter, hash);
 		cand != NULL; cand = (*ops->nextval)(ht, iter, hash))
 	{
@@ -184,11 +277,32 @@ static void run_add(struct bmctx *ctx, int writefd)
 }
 
 
+/* the few slowest adds and where they happened, since growth shows up as
+ * spikes rather than in the mean.
+ */
+#define N_WORST 4
+
 static void report_add(struct bmctx *ctx, int readfd)
 {
 	size_t done;
 	uint32_t *samples = receive_array(readfd, &done);
 	print_tallied(stdout, ctx->name, done, samples);
+
+	size_t worst[N_WORST], n_worst = 0;
+	for(size_t i=0; i < done; i++) {
+		size_t j = n_worst < N_WORST ? n_worst++ : N_WORST;
+		while(j > 0 && samples[worst[j - 1]] < samples[i]) {
+			if(j < N_WORST) worst[j] = worst[j - 1];
+			j--;
+		}
+		if(j < N_WORST) worst[j] = i;
+	}
+	printf("\tworst:");
+	for(size_t i=0; i < n_worst; i++) {
+		printf(" %u at #%zu", samples[worst[i]], worst[i]);
+	}
+	printf("\n");
+
 	free(samples);
 }
 
@@ -267,8 +381,10 @@ static void run_mixed(struct bmctx *ctx, int writefd)
 	const size_t n_words = ctx->n_words;
 
 	uint32_t *cyc_add = malloc(sizeof(uint32_t) * n_words);
-	darray(uint32_t) cyc_del = darray_new();
+	darray(uint32_t) cyc_del = darray_new(), cyc_neg = darray_new();
 	if(cyc_add == NULL) abort();
+	void *iter = malloc(ops->iter_size);
+	if(iter == NULL) abort();
 
 	size_t n = 0;
 	const char *d = ctx->wordbuf;
@@ -293,19 +409,32 @@ static void run_mixed(struct bmctx *ctx, int writefd)
 				abort();
 			}
 			d += strlen(d) + 1;
+
+			/* and a miss, amid the tombstones that deletes leave. */
+			char oth[100];
+			snprintf(oth, sizeof oth, "X%sX", s);
+			hash = rehash_str(oth, NULL);
+			start = rdtsc();
+			void *val = ht_ops_get(ops, ctx->ht, iter, hash, &cmp_str, oth);
+			end = rdtsc();
+			assert(val == NULL);
+			darray_push(cyc_neg, (uint32_t)(end - start));
 		}
 	}
+	free(iter);
 
 	send_array(writefd, n_words, cyc_add); free(cyc_add);
 	send_array(writefd, cyc_del.size, cyc_del.item);
 	darray_free(cyc_del);
+	send_array(writefd, cyc_neg.size, cyc_neg.item);
+	darray_free(cyc_neg);
 }
 
 
 /* TODO: de-copypasta this one wrt report_get, report_add */
 static void report_mixed(struct bmctx *ctx, int readfd)
 {
-	static const char *names[] = { "add", "del" };
+	static const char *names[] = { "add", "del", "cyc-" };
 	for(int i=0; i < ARRAY_SIZE(names); i++) {
 		size_t length;
 		uint32_t *data = receive_array(readfd, &length);
@@ -318,6 +447,146 @@ static void report_mixed(struct bmctx *ctx, int readfd)
 }
 
 
+struct par_add_slice {
+	pthread_t thread;
+	struct bmctx *ctx;
+	pthread_barrier_t *start;
+	const char **strs;
+	size_t *hashes;
+	size_t n;
+};
+
+
+static void *par_add_fn(void *priv)
+{
+	struct par_add_slice *sl = priv;
+	const struct ht_ops *ops = sl->ctx->ops;
+	pthread_barrier_wait(sl->start);
+	for(size_t i=0; i < sl->n; i++) {
+		bool ok = (*ops->add)(sl->ctx->ht, sl->hashes[i], sl->strs[i]);
+		if(!ok) abort();
+	}
+	return NULL;
+}
+
+
+/* add all words from ctx->threads threads at once, each adding its own
+ * contiguous slice. result is the wallclock nanoseconds taken, from start
+ * to the last thread finishing.
+ */
+static void run_par_add(struct bmctx *ctx, int writefd)
+{
+	const size_t n_words = ctx->n_words;
+	const int n_threads = ctx->threads;
+
+	darray(const char *) strs = darray_new();
+	darray(size_t) hashes = darray_new();
+	for(const char *s = ctx->wordbuf; *s != '\0'; s += strlen(s) + 1) {
+		darray_push(strs, s);
+		darray_push(hashes, rehash_str(s, NULL));
+	}
+	assert(strs.size == n_words);
+
+	pthread_barrier_t start;
+	pthread_barrier_init(&start, NULL, n_threads + 1);
+	struct par_add_slice slices[n_threads];
+	for(int i=0; i < n_threads; i++) {
+		size_t first = n_words * i / n_threads,
+			last = n_words * (i + 1) / n_threads;
+		slices[i] = (struct par_add_slice){
+			.ctx = ctx, .start = &start, .n = last - first,
+			.strs = &strs.item[first], .hashes = &hashes.item[first],
+		};
+		int n = pthread_create(&slices[i].thread, NULL,
+			&par_add_fn, &slices[i]);
+		if(n != 0) { perror("pthread_create"); abort(); }
+	}
+
+	struct timespec t0, t1;
+	pthread_barrier_wait(&start);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(int i=0; i < n_threads; i++) pthread_join(slices[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_barrier_destroy(&start);
+
+	/* (past 4.29 seconds, that'd wrap in a sample of send_array().) */
+	uint64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000ull
+		+ t1.tv_nsec - t0.tv_nsec;
+	if(!write_all(writefd, &ns, sizeof ns)) {
+		perror("write (ns)");
+		abort();
+	}
+	darray_free(strs);
+	darray_free(hashes);
+}
+
+
+static void report_par_add(struct bmctx *ctx, int readfd)
+{
+	uint64_t ns;
+	if(!read_all(readfd, &ns, sizeof ns)) {
+		perror("read_all (ns)");
+		abort();
+	}
+	printf("%s: threads=%d, ns=%llu, ns/add=%.1f, Madd/s=%.2f\n",
+		ctx->name, ctx->threads, (unsigned long long)ns,
+		(double)ns / ctx->n_words, ctx->n_words * 1000.0 / ns);
+}
+
+
+/* add all words, then delete all but every fourth one, recording the number
+ * of live tables after each operation. result is two arrays of table counts,
+ * one per phase.
+ */
+static void run_mixed_tables(struct bmctx *ctx, int writefd)
+{
+	const struct ht_ops *ops = ctx->ops;
+	const size_t n_words = ctx->n_words;
+
+	uint32_t *tabs_add = malloc(sizeof(uint32_t) * n_words);
+	darray(uint32_t) tabs_del = darray_new();
+	if(tabs_add == NULL) abort();
+
+	size_t n = 0;
+	for(const char *s = ctx->wordbuf; *s != '\0'; s += strlen(s) + 1) {
+		bool ok = (*ops->add)(ctx->ht, rehash_str(s, NULL), s);
+		if(!ok) abort();
+		tabs_add[n++] = (*ops->ntables)(ctx->ht);
+	}
+	n = 0;
+	for(const char *s = ctx->wordbuf; *s != '\0'; s += strlen(s) + 1) {
+		if(n++ % 4 == 0) continue;
+		bool ok = (*ops->del)(ctx->ht, rehash_str(s, NULL), s);
+		if(!ok) abort();
+		darray_push(tabs_del, (uint32_t)(*ops->ntables)(ctx->ht));
+	}
+
+	send_array(writefd, n_words, tabs_add); free(tabs_add);
+	send_array(writefd, tabs_del.size, tabs_del.item);
+	darray_free(tabs_del);
+}
+
+
+static void report_mixed_tables(struct bmctx *ctx, int readfd)
+{
+	static const char *names[] = { "add", "del" };
+	for(int i=0; i < ARRAY_SIZE(names); i++) {
+		size_t length;
+		uint32_t *data = receive_array(readfd, &length);
+		char hdr[100];
+		snprintf(hdr, sizeof hdr, "%s/%s", ctx->name, names[i]);
+		print_tallied(stdout, hdr, length, data);
+		/* how long the last phase left more than the primary around. */
+		size_t last_multi = 0;
+		for(size_t j=0; j < length; j++) {
+			if(data[j] > 1) last_multi = j + 1;
+		}
+		printf("\tlast op with >1 tables=%zu of %zu\n", last_multi, length);
+		free(data);
+	}
+}
+
+
 static void run_benchmark_with_ops(
 	const struct benchmark *bm, const struct ht_ops *ops,
 	int pipefds[static 2], struct bmctx *bc, bool nofork)
@@ -336,7 +605,11 @@ static void run_benchmark_with_ops(
 		close(pipefds[0]);
 		bc->ht = malloc(ops->size);
 		if(bc->ht == NULL) abort();
-		(*ops->init)(bc->ht, &rehash_str, NULL);
+		if(ops->init != NULL) (*ops->init)(bc->ht, &rehash_str, NULL);
+		else {
+			pht_init_opts(bc->ht, &rehash_str, NULL,
+				&(struct pht_opts){ .flags = ops->flags });
+		}
 		(*bm->run)(bc, pipefds[1]);
 		(*ops->clear)(bc->ht);
 		free(bc->ht);
@@ -357,6 +630,17 @@ static void run_benchmark_with_ops(
 }
 
 
+/* a struct pht variant that only differs in pht_opts.flags. */
+#define PHT_VARIANT(nm, fl) \
+	{ .name = (nm), \
+	  .size = sizeof(struct pht), .iter_size = sizeof(struct pht_iter), \
+	  .flags = (fl), .clear = (void *)&pht_clear, \
+	  .add = (void *)&pht_add, .del = (void *)&pht_del, \
+	  .firstval = (void *)&pht_firstval, \
+	  .nextval = (void *)&pht_nextval, \
+	  .ntables = (void *)&pht_ntables, }
+
+
 int main(int argc, char *argv[])
 {
 	static const struct option opts[] = {
@@ -424,7 +708,40 @@ int main(int argc, char *argv[])
 		  .init = (void *)&pht_init, .clear = (void *)&pht_clear,
 		  .add = (void *)&pht_add, .del = (void *)&pht_del,
 		  .firstval = (void *)&pht_firstval,
-		  .nextval = (void *)&pht_nextval, },
+		  .nextval = (void *)&pht_nextval,
+		  .ntables = (void *)&pht_ntables, },
+		{ .name = "pht-typed",
+		  .size = sizeof(struct pht_words),
+		  .iter_size = sizeof(struct pht_words_iter),
+		  .init = &pht_typed_init, .clear = (void *)&pht_clear,
+		  .add = (void *)&pht_add, .del = (void *)&pht_del,
+		  .firstval = (void *)&pht_firstval,
+		  .nextval = (void *)&pht_nextval,
+		  .get = &pht_typed_get,
+		  .ntables = (void *)&pht_ntables, },
+		PHT_VARIANT("pht-ctrl", PHT_CTRL),
+		PHT_VARIANT("pht-bucket", PHT_BUCKET),
+		PHT_VARIANT("pht-robin", PHT_ROBIN_HOOD),
+		PHT_VARIANT("pht-shiftdel", PHT_SHIFT_DEL),
+		PHT_VARIANT("pht-purge", PHT_PURGE),
+		PHT_VARIANT("pht-filter", PHT_FILTER),
+		PHT_VARIANT("pht-storehash", PHT_STORE_HASH),
+		PHT_VARIANT("pht-migdel", PHT_MIG_ON_DEL),
+		{ .name = "pht-hugepage",
+		  .size = sizeof(struct pht), .iter_size = sizeof(struct pht_iter),
+		  .init = &pht_huge_init, .clear = (void *)&pht_clear,
+		  .add = (void *)&pht_add, .del = (void *)&pht_del,
+		  .firstval = (void *)&pht_firstval,
+		  .nextval = (void *)&pht_nextval,
+		  .ntables = (void *)&pht_ntables, },
+		{ .name = "pht_sharded",
+		  .size = sizeof(struct pht_sharded),
+		  .iter_size = sizeof(struct pht_sharded_iter),
+		  .init = &sharded_init, .clear = (void *)&pht_sharded_clear,
+		  .add = (void *)&pht_sharded_add, .del = (void *)&pht_sharded_del,
+		  .firstval = (void *)&pht_sharded_firstval,
+		  .nextval = (void *)&pht_sharded_nextval,
+		  .mt = true, },
 		{ .name = "htable",
 		  .size = sizeof(struct htable), .iter_size = sizeof(struct htable_iter),
 		  .init = (void *)&htable_init, .clear = (void *)&htable_clear,
@@ -437,6 +754,10 @@ int main(int argc, char *argv[])
 		{ .name = "add", .run = &run_add, .report = &report_add },
 		{ .name = "get", .run = &run_get, .report = &report_get },
 		{ .name = "mixed", .run = &run_mixed, .report = &report_mixed },
+		{ .name = "mixed-tables", .run = &run_mixed_tables,
+		  .report = &report_mixed_tables, .ntables = true },
+		{ .name = "par-add", .run = &run_par_add, .report = &report_par_add,
+		  .mt = true },
 	};
 
 	for(const struct benchmark *bm = &benchmarks[0];
@@ -445,12 +766,19 @@ int main(int argc, char *argv[])
 		for(const struct ht_ops *ops = &variants[0];
 			ops < &variants[ARRAY_SIZE(variants)]; ops++)
 		{
-			int fds[2], n = pipe(fds);
-			if(n < 0) { perror("pipe"); abort(); }
-			struct bmctx bc = { .ops = ops, .wordbuf = wordbuf,
-				.n_words = n_words };
-			snprintf(bc.name, sizeof bc.name, "%s[%s]", bm->name, ops->name);
-			run_benchmark_with_ops(bm, ops, fds, &bc, nofork);
+			if(bm->mt && !ops->mt) continue;
+			if(bm->ntables && ops->ntables == NULL) continue;
+			for(int threads = 1; threads <= (bm->mt ? MAX_THREADS : 1);
+				threads *= 2)
+			{
+				int fds[2], n = pipe(fds);
+				if(n < 0) { perror("pipe"); abort(); }
+				struct bmctx bc = { .ops = ops, .wordbuf = wordbuf,
+					.n_words = n_words, .threads = threads };
+				snprintf(bc.name, sizeof bc.name, "%s[%s]",
+					bm->name, ops->name);
+				run_benchmark_with_ops(bm, ops, fds, &bc, nofork);
+			}
 		}
 	}
 
@@ -2,13 +2,22 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <ccan/list/list.h>
 #include <ccan/minmax/minmax.h>
 #include <ccan/likely/likely.h>
 #include <ccan/bitops/bitops.h>
 
+#if UINTPTR_MAX == UINT64_MAX && defined(__AVX2__)
+#include <immintrin.h>
+#elif UINTPTR_MAX == UINT64_MAX && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "pht.h"
 
 
@@ -16,9 +25,38 @@
 #define NO_PERFECT_BIT (sizeof(uintptr_t) * CHAR_BIT - 1)
 #define TOMBSTONE (1)
 
+/* tables at least this big come straight from mmap() by default, so that
+ * their pages are zeroed as adds and migration first touch them rather than
+ * all at once by the add that allocates them.
+ */
+#define MMAP_MIN ((size_t)1 << 20)
+
+/* how many items ahead the batched functions prefetch. about the number of
+ * L1 misses a core can have in flight.
+ */
+#define PREFETCH_AHEAD 16
+
+/* how many slots purge_step() examines per pht_add(). */
+#define PURGE_STEP 16
+
+/* how many slots filter_step() examines per pht_add(). */
+#define FILTER_STEP 64
+
 /* _pht_table flags */
 #define KEEP_CHAIN 1
 #define CHAIN_SAFE 2
+#define COMPACT 4	/* 32-bit slots, see fits_compact() */
+#define MAP 8	/* value words follow the slots, see t_vals() */
+#define CTRL 16	/* control bytes follow those, see t_ctrl() */
+#define BUCKET 32	/* perfect means in the home bucket, see t_bucket_slots() */
+#define ROBIN 64	/* chains sorted by distance, see table_add_robin() */
+#define FILTER 128	/* a filter follows the control bytes, see t_filter() */
+#define HASHES 256	/* item hashes follow the values, see t_hashes() */
+
+/* under PHT_CTRL, tables this big and up get control bytes. smaller ones
+ * stay in cache well enough that probing slots directly is just as fast.
+ */
+#define CTRL_MIN_BITS 16
 
 
 struct _pht_table
@@ -34,16 +72,162 @@ struct _pht_table
 	 * non-empty slot following an empty.
 	 */
 	size_t chain_start;
+	/* nextmig and chain_start as seen by iteration. these are published
+	 * only once the items they skip over are present in the primary, so
+	 * that concurrent readers never lose an item to migration.
+	 */
+	size_t it_nextmig, it_chain_start;
 	int credit;	/* # of extra entries moved without rehash */
+	size_t purge;	/* next slot for purge_step() */
+	/* no item is farther than this from its home slot, see note_dist(). */
+	size_t max_dist;
+	/* next slot for filter_step(), 1 << bits once the filter is built. */
+	size_t filter_next;
 	uintptr_t common_bits, common_mask;
 	uint16_t flags;	/* , as is tradition */
 	uint8_t bits;	/* size_log2 */
 	uint8_t perfect_bit;
+	/* under PHT_CONCURRENT_READ, tables removed from pht.tables wait in
+	 * pht.limbo until every reader that could've seen them has left. also
+	 * links pht.cache.
+	 */
+	struct _pht_table *limbo;
+	unsigned long retired;	/* pht.epoch at removal */
 
-	uintptr_t table[];
+	/* or uint32_t under COMPACT. tables are allocated on a cacheline, and
+	 * the slots start on one as well, so that PHT_BUCKET's buckets are whole
+	 * lines.
+	 */
+	uintptr_t table[] __attribute__((aligned(64)));
 };
 
 
+/* slots and published migration state are read without locks under
+ * PHT_CONCURRENT_READ, so they're loaded and stored whole, and stores made
+ * visible in program order.
+ */
+static inline uintptr_t slot_get(const struct _pht_table *t, size_t i) {
+	if(t->flags & COMPACT) {
+		return __atomic_load_n(&((const uint32_t *)t->table)[i],
+			__ATOMIC_ACQUIRE);
+	} else {
+		return __atomic_load_n(&t->table[i], __ATOMIC_ACQUIRE);
+	}
+}
+
+
+static inline void slot_set(struct _pht_table *t, size_t i, uintptr_t e) {
+	if(t->flags & COMPACT) {
+		assert(e <= UINT32_MAX);
+		__atomic_store_n(&((uint32_t *)t->table)[i], e, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&t->table[i], e, __ATOMIC_RELEASE);
+	}
+}
+
+
+/* the same for the writer, which needn't synchronize with itself. */
+static inline uintptr_t t_slot(const struct _pht_table *t, size_t i) {
+	return t->flags & COMPACT ? ((const uint32_t *)t->table)[i] : t->table[i];
+}
+
+
+static inline size_t t_slot_size(const struct _pht_table *t) {
+	return t->flags & COMPACT ? sizeof(uint32_t) : sizeof(uintptr_t);
+}
+
+
+/* for prefetching and cacheline arithmetic. */
+static inline const void *slot_addr(const struct _pht_table *t, size_t i) {
+	return (const char *)t->table + i * t_slot_size(t);
+}
+
+
+/* under MAP, the value words of the slots, in a parallel array after them
+ * so that group probes and 32-bit slots work the same as without.
+ */
+static inline uintptr_t *t_vals(const struct _pht_table *t) {
+	assert(t->flags & MAP);
+	return (uintptr_t *)slot_addr(t, (size_t)1 << t->bits);
+}
+
+
+/* under HASHES, each item's hash in another parallel array after those, so
+ * that moving it around never needs ht->rehash. see item_hash().
+ */
+static inline size_t *t_hashes(const struct _pht_table *t) {
+	assert(t->flags & HASHES);
+	return (size_t *)((char *)slot_addr(t, (size_t)1 << t->bits)
+		+ (t->flags & MAP ? sizeof(uintptr_t) << t->bits : 0));
+}
+
+
+/* under CTRL, a byte per slot that's 0 for empty, TOMBSTONE for deleted, and
+ * ctrl_tag() of the item's hash otherwise, so that probing looks at 16 slots
+ * with one compare and loads only the candidates.
+ */
+static inline uint8_t *t_ctrl(const struct _pht_table *t) {
+	assert(t->flags & CTRL);
+	return (uint8_t *)slot_addr(t, (size_t)1 << t->bits)
+		+ (t->flags & MAP ? sizeof(uintptr_t) << t->bits : 0)
+		+ (t->flags & HASHES ? sizeof(size_t) << t->bits : 0);
+}
+
+
+/* under FILTER, 4 bits per slot that a secondary sets for the home slot and
+ * stash bits of each of its items, so that lookups may skip it when theirs
+ * is clear. see filter_step().
+ */
+static inline uint8_t *t_filter(const struct _pht_table *t) {
+	assert(t->flags & FILTER);
+	return (uint8_t *)slot_addr(t, (size_t)1 << t->bits)
+		+ (t->flags & MAP ? sizeof(uintptr_t) << t->bits : 0)
+		+ (t->flags & HASHES ? sizeof(size_t) << t->bits : 0)
+		+ (t->flags & CTRL ? (size_t)1 << t->bits : 0);
+}
+
+
+static inline uint8_t ctrl_tag(size_t hash) {
+	return 0x80 | (hash & 0x7f);
+}
+
+
+/* called before slot_set(). concurrent readers may end a probe on a control
+ * byte without loading its slot, so it's a release as well, so that one that
+ * sees it also sees what was stored before, e.g. an item bumped ahead of it.
+ * a no-op for tables without CTRL.
+ */
+static inline void ctrl_set(struct _pht_table *t, size_t i, uint8_t c) {
+	if(t->flags & CTRL) __atomic_store_n(&t_ctrl(t)[i], c, __ATOMIC_RELEASE);
+}
+
+
+static inline size_t t_nextmig(const struct _pht_table *t) {
+	return __atomic_load_n(&t->it_nextmig, __ATOMIC_ACQUIRE);
+}
+
+
+static inline size_t t_chain_start(const struct _pht_table *t) {
+	return __atomic_load_n(&t->it_chain_start, __ATOMIC_ACQUIRE);
+}
+
+
+/* (relaxed, since it's raised before the slot_set() that needs it, and
+ * read after the slot_get() that may.)
+ */
+static inline size_t t_max_dist(const struct _pht_table *t) {
+	return __atomic_load_n(&t->max_dist, __ATOMIC_RELAXED);
+}
+
+
+/* called before storing an item @dist slots away from its home. */
+static inline void note_dist(struct _pht_table *t, size_t dist) {
+	if(dist > t->max_dist) {
+		__atomic_store_n(&t->max_dist, dist, __ATOMIC_RELAXED);
+	}
+}
+
+
 static bool is_valid(uintptr_t e) {
 	return e != 0 && e != TOMBSTONE;
 }
@@ -69,6 +253,17 @@ static uintptr_t t_perfect_mask(const struct _pht_table *t) {
 }
 
 
+/* under BUCKET, slots are grouped a cacheline's worth at a time, and an
+ * item's home is the whole group rather than a single slot. probing starts
+ * from the group's first slot, and the perfect bit marks items in their home
+ * group. 1 for all other tables.
+ */
+static inline size_t t_bucket_slots(const struct _pht_table *t) {
+	if(~t->flags & BUCKET) return 1;
+	return min_t(size_t, 64 / t_slot_size(t), (size_t)1 << t->bits);
+}
+
+
 static inline size_t t_bucket(const struct _pht_table *t, size_t hash) {
 	/* increase at the low end to optimize rehash avoidance. since many hash
 	 * functions are stronger at the low end, rotate to the right 17 bits
@@ -76,7 +271,16 @@ static inline size_t t_bucket(const struct _pht_table *t, size_t hash) {
 	 */
 	hash ^= (hash >> 17) | (hash << (sizeof hash * CHAR_BIT - 17));
 	assert(t->bits > 0);
-	return hash >> (sizeof hash * CHAR_BIT - t->bits);
+	return hash >> (sizeof hash * CHAR_BIT - t->bits)
+		& ~(t_bucket_slots(t) - 1);
+}
+
+
+/* true when slot @i is where @hash's items are stored perfectly. */
+static inline bool t_in_home(
+	const struct _pht_table *t, size_t i, size_t hash)
+{
+	return (i & ~(t_bucket_slots(t) - 1)) == t_bucket(t, hash);
 }
 
 
@@ -92,12 +296,85 @@ static inline uintptr_t ptr_to_entry(
 }
 
 
+/* the common bits of an entry that hold hash bits, i.e. all but the perfect
+ * bit, and those only up to the slot width.
+ */
+static inline uintptr_t t_stash_mask(const struct _pht_table *t) {
+	uintptr_t m = t->common_mask & ~t_perfect_mask(t);
+	return t->flags & COMPACT ? m & UINT32_MAX : m;
+}
+
+
 static inline uintptr_t stash_bits(const struct _pht_table *t, size_t hash) {
 	/* same reason as t_bucket(), but this time because most of the common
 	 * bits are up high. rotation distance picked arbitrarily.
 	 */
 	hash ^= (hash >> 14) | (hash << (sizeof hash * CHAR_BIT - 14));
-	return hash & t->common_mask & ~t_perfect_mask(t);
+	return hash & t_stash_mask(t);
+}
+
+
+/* the hash of the item in slot @i of @t, which is either stored or
+ * recomputed.
+ */
+static inline size_t item_hash(
+	const struct pht *ht, const struct _pht_table *t, size_t i)
+{
+	assert(is_valid(t_slot(t, i)));
+	if(t->flags & HASHES) return t_hashes(t)[i];
+	return (*ht->rehash)(entry_to_ptr(t, t_slot(t, i)), ht->priv);
+}
+
+
+/* how far the item in slot @i of @t is from its home slot. */
+static size_t t_dist(
+	const struct pht *ht, const struct _pht_table *t, size_t i)
+{
+	uintptr_t e = t_slot(t, i);
+	assert(is_valid(e));
+	if(e & t_perfect_mask(t)) return 0;
+	size_t home = t_bucket(t, item_hash(ht, t, i));
+	return (i - home) & (((size_t)1 << t->bits) - 1);
+}
+
+
+/* a bound on the distance of an item about to be stored in slot @i of @t
+ * from a home that's not known. its hash chain is contiguous from there, so
+ * that's no farther back than the start of the run of non-empty slots
+ * before @i, or anywhere at all in a table that tombstones have left with
+ * no empty slot (see can_shift()).
+ */
+static size_t run_dist(const struct _pht_table *t, size_t i)
+{
+	size_t mask = ((size_t)1 << t->bits) - 1, r = i;
+	while(t_slot(t, (r - 1) & mask) != 0) {
+		r = (r - 1) & mask;
+		if(r == i) return mask;
+	}
+	return (i - r) & mask;
+}
+
+
+/* the filter bit of items at @home with @stash, one of four per slot picked
+ * by a fold of the stash bits.
+ */
+static inline size_t filter_bit(size_t home, uintptr_t stash) {
+	return home << 2 | (size_t)(((uint64_t)stash * 0x9e3779b97f4a7c15ull) >> 62);
+}
+
+
+static inline bool filter_has(const struct _pht_table *t, size_t bit) {
+	return t_filter(t)[bit >> 3] & (1 << (bit & 7));
+}
+
+
+/* true when @t's filter is built and says no item of @hash is there. */
+static inline bool filter_skip(const struct _pht_table *t, size_t hash)
+{
+	return (t->flags & FILTER)
+		&& __atomic_load_n(&t->filter_next, __ATOMIC_ACQUIRE)
+			== (size_t)1 << t->bits
+		&& !filter_has(t, filter_bit(t_bucket(t, hash), stash_bits(t, hash)));
 }
 
 
@@ -108,19 +385,308 @@ void pht_init(struct pht *ht,
 }
 
 
+void pht_init_opts(struct pht *ht,
+	size_t (*rehash)(const void *elem, void *priv), void *priv,
+	const struct pht_opts *opts)
+{
+	assert(~opts->flags & PHT_CONCURRENT_READ
+		|| (~opts->flags & PHT_MIG_ON_GET && ~opts->flags & PHT_MAP
+			&& ~opts->flags & PHT_ROBIN_HOOD
+			&& ~opts->flags & PHT_SHIFT_DEL
+			&& ~opts->flags & PHT_PURGE));
+	assert(~opts->flags & PHT_ROBIN_HOOD || ~opts->flags & PHT_BUCKET);
+	pht_init(ht, rehash, priv);
+	ht->flags = opts->flags;
+	ht->shrink = opts->shrink;
+	ht->alloc = opts->alloc;
+	ht->cache_max = opts->cache_max;
+	if(ht->shrink > 0) ht->flags |= PHT_MIG_ON_DEL;
+	if(ht->flags & (PHT_ROBIN_HOOD | PHT_SHIFT_DEL | PHT_PURGE)) {
+		ht->flags |= PHT_STORE_HASH;
+	}
+}
+
+
+void pht_reader_add(struct pht *ht, struct pht_reader *rd)
+{
+	rd->epoch = 0;
+	rd->next = __atomic_load_n(&ht->readers, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&ht->readers, &rd->next, rd,
+		true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+		/* try again with the new head. */
+	}
+}
+
+
+void pht_reader_del(struct pht *ht, struct pht_reader *rd)
+{
+	assert(rd->epoch == 0);
+	struct pht_reader *head = rd;
+	if(__atomic_compare_exchange_n(&ht->readers, &head, rd->next,
+		false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+		return;
+	}
+	/* readers are only ever added at the head, so everything after it is
+	 * the writer's to change.
+	 */
+	for(struct pht_reader *prev = head; prev != NULL; prev = prev->next) {
+		if(prev->next == rd) {
+			prev->next = rd->next;
+			return;
+		}
+	}
+	assert(false);
+}
+
+
+static size_t t_size(int bits, unsigned flags) {
+	return sizeof(struct _pht_table)
+		+ ((flags & COMPACT ? sizeof(uint32_t) : sizeof(uintptr_t)) << bits)
+		+ (flags & MAP ? sizeof(uintptr_t) << bits : 0)
+		+ (flags & HASHES ? sizeof(size_t) << bits : 0)
+		+ (flags & CTRL ? (size_t)1 << bits : 0)
+		+ (flags & FILTER ? (size_t)1 << bits >> 1 : 0);
+}
+
+
+static size_t t_bytes(const struct _pht_table *t) {
+	return t_size(t->bits, t->flags);
+}
+
+
+/* true when entries of a table with @common_mask fit in 32-bit slots: every
+ * uncommon bit and the perfect bit, i.e. the lowest common bit above the
+ * very bottom, must be below bit 32.
+ */
+static bool fits_compact(uintptr_t common_mask) {
+#if UINTPTR_MAX == UINT64_MAX
+	return (~common_mask & ~(uintptr_t)0x7fffffff) == 0;
+#else
+	return false;
+#endif
+}
+
+
+static void *alloc_zeroed(const struct pht *ht, size_t size)
+{
+	if(ht->alloc != NULL) {
+		return (*ht->alloc->alloc_zeroed)(size, ht->alloc->priv);
+	} else if(size < MMAP_MIN) {
+		void *p;
+		if(posix_memalign(&p, 64, size) != 0) return NULL;
+		return memset(p, 0, size);
+	} else {
+		void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+	}
+}
+
+
+/* give @t back to where alloc_zeroed() got it. */
+static void table_dealloc(const struct pht *ht, struct _pht_table *t)
+{
+	size_t sz = t_bytes(t);
+	if(ht->alloc != NULL) (*ht->alloc->free)(t, sz, ht->alloc->priv);
+	else if(sz < MMAP_MIN) free(t);
+	else munmap(t, sz);
+}
+
+
+/* zero @t for reuse. a table from mmap() has its whole pages dropped
+ * instead, to be faulted back in as zeroes the same way as a fresh one.
+ */
+static void table_zero(const struct pht *ht, struct _pht_table *t)
+{
+	size_t sz = t_bytes(t), page = sysconf(_SC_PAGESIZE);
+	if(ht->alloc == NULL && sz >= MMAP_MIN) {
+		size_t whole = sz & ~(page - 1);
+		madvise(t, whole, MADV_DONTNEED);
+		memset((char *)t + whole, 0, sz - whole);
+	} else {
+		memset(t, 0, sz);
+	}
+}
+
+
+/* keep @t in @ht->cache for reuse, evicting the oldest tables past
+ * cache_max, or give it back right away if it'd never fit.
+ */
+static void table_retire(struct pht *ht, struct _pht_table *t)
+{
+	size_t sz = t_bytes(t);
+	if(sz > ht->cache_max) {
+		table_dealloc(ht, t);
+		return;
+	}
+	t->limbo = ht->cache;
+	ht->cache = t;
+	ht->cache_bytes += sz;
+	if(ht->cache_bytes <= ht->cache_max) return;
+
+	struct _pht_table **pp = &ht->cache, *cur;
+	size_t kept = 0;
+	while((cur = *pp) != NULL) {
+		kept += t_bytes(cur);
+		if(kept <= ht->cache_max) pp = &cur->limbo;
+		else {
+			*pp = cur->limbo;
+			kept -= t_bytes(cur);
+			table_dealloc(ht, cur);
+		}
+	}
+	ht->cache_bytes = kept;
+}
+
+
+/* take a table of @sz bytes out of @ht->cache, zeroed. NULL if there's
+ * none.
+ */
+static struct _pht_table *cache_get(struct pht *ht, size_t sz)
+{
+	struct _pht_table **pp = &ht->cache, *t;
+	while((t = *pp) != NULL && t_bytes(t) != sz) pp = &t->limbo;
+	if(t != NULL) {
+		*pp = t->limbo;
+		ht->cache_bytes -= sz;
+		table_zero(ht, t);
+	}
+	return t;
+}
+
+
+/* free @t, which has been removed from @ht->tables, or under
+ * PHT_CONCURRENT_READ put it in limbo for reclaim() to free later.
+ */
+static void table_free(struct pht *ht, struct _pht_table *t)
+{
+	if(~ht->flags & PHT_CONCURRENT_READ) table_retire(ht, t);
+	else {
+		t->retired = ht->epoch;
+		t->limbo = ht->limbo;
+		ht->limbo = t;
+	}
+}
+
+
+/* list_add() and list_del_from() for @ht->tables. under PHT_CONCURRENT_READ
+ * readers walk the list backward without locks, see it_next_table(), so the
+ * prev links that they follow are published with release stores only once
+ * whatever they point to is in place. a table that's taken out keeps its own
+ * links so that a reader standing on it may carry on from there, and limbo
+ * keeps its memory around for as long as that may happen.
+ */
+static void tables_add(struct pht *ht, struct _pht_table *t)
+{
+	struct list_node *head = &ht->tables.n, *next = head->next;
+	t->link.next = next;
+	t->link.prev = head;
+	__atomic_store_n(&next->prev, &t->link, __ATOMIC_RELEASE);
+	__atomic_store_n(&head->next, &t->link, __ATOMIC_RELEASE);
+}
+
+
+static void tables_del(struct pht *ht, struct _pht_table *t)
+{
+	struct list_node *n = &t->link;
+	__atomic_store_n(&n->next->prev, n->prev, __ATOMIC_RELEASE);
+	__atomic_store_n(&n->prev->next, n->next, __ATOMIC_RELEASE);
+}
+
+
+/* free tables in limbo that no reader can still be looking at. a reader
+ * whose recorded epoch is at most a table's ->retired may have entered
+ * before the table was unlinked; later ones saw the epoch incremented
+ * below, which happens after the unlink, and can't reach it.
+ */
+static void reclaim(struct pht *ht)
+{
+	if(likely(ht->limbo == NULL)) return;
+
+	__atomic_store_n(&ht->epoch, ht->epoch + 1, __ATOMIC_RELEASE);
+	/* pairs with the fence in pht_read_enter(). */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	unsigned long oldest = ULONG_MAX;
+	for(const struct pht_reader *rd = __atomic_load_n(&ht->readers,
+			__ATOMIC_ACQUIRE);
+		rd != NULL; rd = rd->next)
+	{
+		unsigned long e = __atomic_load_n(&rd->epoch, __ATOMIC_ACQUIRE);
+		if(e > 0) oldest = min(oldest, e - 1);
+	}
+
+	struct _pht_table **pp = &ht->limbo, *t;
+	while((t = *pp) != NULL) {
+		if(t->retired < oldest) {
+			*pp = t->limbo;
+			table_retire(ht, t);
+		} else {
+			pp = &t->limbo;
+		}
+	}
+}
+
+
 size_t pht_count(const struct pht *ht) {
 	return ht->elems;
 }
 
 
+size_t pht_ntables(const struct pht *ht)
+{
+	size_t n = 0;
+	struct _pht_table *t;
+	list_for_each(&ht->tables, t, link) n++;
+	return n;
+}
+
+
 void pht_clear(struct pht *ht)
 {
 	struct _pht_table *cur, *next;
 	list_for_each_safe(&ht->tables, cur, next, link) {
 		list_del_from(&ht->tables, &cur->link);
-		free(cur);
+		table_dealloc(ht, cur);
 	}
 	assert(list_empty(&ht->tables));
+	while(ht->limbo != NULL) {
+		cur = ht->limbo;
+		ht->limbo = cur->limbo;
+		table_dealloc(ht, cur);
+	}
+	while(ht->cache != NULL) {
+		cur = ht->cache;
+		ht->cache = cur->limbo;
+		table_dealloc(ht, cur);
+	}
+	ht->cache_bytes = 0;
+}
+
+
+void pht_reset(struct pht *ht)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link),
+		*cur, *next;
+	if(t == NULL) return;
+	list_for_each_safe(&ht->tables, cur, next, link) {
+		if(cur == t) continue;
+		list_del_from(&ht->tables, &cur->link);
+		table_retire(ht, cur);
+	}
+	assert(t->nextmig == 0
+		&& (t->flags
+			& ~(COMPACT | MAP | CTRL | BUCKET | ROBIN | FILTER | HASHES)) == 0);
+	assert(t->filter_next == 0);
+	memset(t->table, 0, t_slot_size(t) << t->bits);
+	if(t->flags & CTRL) memset(t_ctrl(t), 0, (size_t)1 << t->bits);
+	t->elems = 0;
+	t->deleted = 0;
+	t->credit = 0;
+	t->purge = 0;
+	t->max_dist = 0;
+	ht->elems = 0;
 }
 
 
@@ -139,7 +705,7 @@ struct pht *pht_check(const struct pht *ht, const char *abortstr)
 		size_t deleted = 0, empty = 0, item = 0;
 		uintptr_t perf_mask = t_perfect_mask(t);
 		for(size_t i=0; i < (size_t)1 << t->bits; i++) {
-			uintptr_t e = t->table[i];
+			uintptr_t e = t_slot(t, i);
 			switch(e) {
 				case 0: empty++; break;
 				case TOMBSTONE: deleted++; break;
@@ -147,6 +713,7 @@ struct pht *pht_check(const struct pht *ht, const char *abortstr)
 					assert(is_valid(e));
 					if(i >= t->nextmig) item++; else empty++;
 			}
+			assert(~t->flags & CTRL || is_valid(e) || t_ctrl(t)[i] == e);
 
 			/* (we require these things of items behind the migration horizon,
 			 * too, for the purpose of catching memory corruption there as
@@ -154,24 +721,39 @@ struct pht *pht_check(const struct pht *ht, const char *abortstr)
 			 */
 			if(is_valid(e)) {
 				uintptr_t extra = e & t->common_mask;
-				size_t hash = (*ht->rehash)(entry_to_ptr(t, e), ht->priv);
+				size_t hash = item_hash(ht, t, i);
 
 				assert((extra & ~perf_mask) == stash_bits(t, hash));
-				assert(!!(e & perf_mask) == (i == t_bucket(t, hash)));
+				assert(~t->flags & CTRL || t_ctrl(t)[i] == ctrl_tag(hash));
+				assert(!!(e & perf_mask) == t_in_home(t, i, hash));
+				assert(((i - t_bucket(t, hash)) & (((size_t)1 << t->bits) - 1))
+					<= t->max_dist);
+				assert(~t->flags & FILTER || t->filter_next <= i
+					|| filter_has(t,
+						filter_bit(t_bucket(t, hash), stash_bits(t, hash))));
 				if(~e & perf_mask) {
 					/* a contiguous hash chain exists from the home slot to
 					 * `i'.
 					 */
-					size_t slot = t_bucket(t, hash);
+					size_t slot = t_bucket(t, hash),
+						mask = ((size_t)1 << t->bits) - 1;
 					while(slot != i) {
-						assert(t->table[slot] != 0);
-						slot = (slot + 1) & (((size_t)1 << t->bits) - 1);
+						assert(t_slot(t, slot) != 0);
+						/* and under ROBIN, nothing on it is closer to home
+						 * than `e' would be there.
+						 */
+						assert(~t->flags & ROBIN || !is_valid(t_slot(t, slot))
+							|| t_dist(ht, t, slot)
+								>= ((slot - t_bucket(t, hash)) & mask));
+						slot = (slot + 1) & mask;
 					}
 				}
 			}
 		}
 		assert(deleted == t->deleted);
 		assert(item == t->elems);
+		assert(t->it_nextmig <= t->nextmig);
+		assert(t->it_chain_start <= t->chain_start);
 		assert(empty == ((size_t)1 << t->bits) - t->deleted - t->elems);
 
 		/* only the first secondary's tombstones are retained, since migration
@@ -188,125 +770,336 @@ struct pht *pht_check(const struct pht *ht, const char *abortstr)
 }
 
 
-static struct _pht_table *new_table(
-	struct pht *ht, struct _pht_table *prev,
-	bool keep_chain)
+/* size_log2 of a table that holds @room items before hitting
+ * t_max_elems().
+ */
+static int room_bits(size_t room)
 {
-	/* find a size that can hold all items in @ht twice before hitting
-	 * t_max_elems(), and always allocates at least 4 items for convenience
-	 * wrt ->bits.
-	 */
-	size_t target = max_t(size_t, 4, (ht->elems * 2 * 4) / 3);
+	/* always allocates at least 4 items for convenience wrt ->bits. */
+	size_t target = max_t(size_t, 4, (room * 4) / 3);
 	int bits = sizeof(uintptr_t) * CHAR_BIT == 32 ? bitops_hs32(target)
 		: bitops_hs64(target);
 	if((size_t)1 << bits < target) bits++;
 	assert((size_t)1 << bits >= target);
 	assert(bits > 1);
-	assert(((size_t)3 << bits) / 4 >= ht->elems * 2);
+	assert(((size_t)3 << bits) / 4 >= room);
+	return bits;
+}
+
 
-	struct _pht_table *t = calloc(1, sizeof *t + (sizeof(uintptr_t) << bits));
+/* allocate a table for @ht of room_bits(@room), taking its common bits
+ * from @prev, if any. the caller sets it up further, starting with dropping
+ * @diffmask from the common bits, which decides the slot width, and then
+ * adds it with link_table().
+ */
+static struct _pht_table *alloc_table_room(
+	struct pht *ht, const struct _pht_table *prev, size_t room,
+	uintptr_t diffmask)
+{
+	int bits = room_bits(room);
+	bool compact = fits_compact(
+		(prev != NULL ? prev->common_mask : ~0ul) & ~diffmask);
+
+	unsigned flags = (compact ? COMPACT : 0)
+		| (ht->flags & PHT_MAP ? MAP : 0)
+		| ((ht->flags & PHT_CTRL) && bits >= CTRL_MIN_BITS ? CTRL : 0)
+		| (ht->flags & PHT_BUCKET ? BUCKET : 0)
+		| (ht->flags & PHT_ROBIN_HOOD ? ROBIN : 0)
+		| (ht->flags & PHT_FILTER ? FILTER : 0)
+		| (ht->flags & PHT_STORE_HASH ? HASHES : 0);
+	size_t sz = t_size(bits, flags);
+	struct _pht_table *t = cache_get(ht, sz);
+	if(t == NULL) t = alloc_zeroed(ht, sz);
 	if(t == NULL) return NULL;
 
+	assert(((uintptr_t)t & 63) == 0);
 	assert(t->elems == 0);
 	assert(t->deleted == 0);
 	assert(t->nextmig == 0);
 	assert(t->chain_start == 0);
 	assert(t->credit == 0);
+	assert(t->purge == 0);
+	assert(t->max_dist == 0);
+	assert(t->filter_next == 0);
 	t->bits = bits;
+	t->flags |= flags;
 	if(prev != NULL) {
 		t->common_mask = prev->common_mask;
 		t->common_bits = prev->common_bits;
 		t->perfect_bit = prev->perfect_bit;
-		assert(~prev->flags & KEEP_CHAIN);
-		assert(~prev->flags & CHAIN_SAFE);
-		if(keep_chain && prev->bits >= t->bits) prev->flags |= KEEP_CHAIN;
 	} else {
 		t->perfect_bit = NO_PERFECT_BIT;
 		t->common_mask = ~0ul;
 		assert(t->common_bits == 0);
 	}
-	list_add(&ht->tables, &t->link);
+
+	return t;
+}
+
+
+/* a table with room for all items in @ht, plus @extra about to be added,
+ * twice.
+ */
+static struct _pht_table *alloc_table(
+	struct pht *ht, const struct _pht_table *prev, size_t extra)
+{
+	return alloc_table_room(ht, prev, (ht->elems + extra) * 2, 0);
+}
+
+
+/* make @t the primary table of @ht, with @prev the one it replaces. */
+static void link_table(
+	struct pht *ht, struct _pht_table *t, struct _pht_table *prev,
+	bool keep_chain)
+{
+	if(prev != NULL) {
+		assert(~prev->flags & KEEP_CHAIN);
+		assert(~prev->flags & CHAIN_SAFE);
+		/* (recreated tombstones would be in the way of ROBIN's order, and
+		 * only serve fast_migrate(), which ROBIN doesn't use.)
+		 */
+		if(keep_chain && prev->bits >= t->bits && (~t->flags & ROBIN)) {
+			prev->flags |= KEEP_CHAIN;
+		}
+	}
+	/* (@t's contents become visible to concurrent readers along with @t.) */
+	tables_add(ht, t);
 
 	/* since migration proceeds oldest-first, we must only rely on tombstone
-	 * recreation in the most recent table.
+	 * recreation in the most recent table. likewise a chain found safe
+	 * wrt the previous primary isn't so wrt @t, which has none of it, and
+	 * credit for migrating ahead was spent against the previous primary's
+	 * room and mustn't eat into @t's.
 	 */
 	struct _pht_table *oth;
 	list_for_each(&ht->tables, oth, link) {
 		if(oth != t && oth != prev) oth->flags &= ~KEEP_CHAIN;
+		oth->flags &= ~CHAIN_SAFE;
+		oth->credit = 0;
 	}
+}
+
 
+static struct _pht_table *new_table(
+	struct pht *ht, struct _pht_table *prev,
+	bool keep_chain, size_t extra)
+{
+	struct _pht_table *t = alloc_table(ht, prev, extra);
+	if(t != NULL) link_table(ht, t, prev, keep_chain);
 	return t;
 }
 
 
+/* link @t in place of the primary @prev by link_table(), and dispose of
+ * @prev right away if it's empty.
+ */
+static void replace_table(
+	struct pht *ht, struct _pht_table *t, struct _pht_table *prev,
+	bool keep_chain)
+{
+	link_table(ht, t, prev, keep_chain);
+	if(prev->elems == 0) {
+		tables_del(ht, prev);
+		table_free(ht, prev);
+	}
+}
+
+
+/* true when @p can be stored in @t as it is, i.e. it matches @t's common
+ * bits and the rest of it looks like neither 0 nor TOMBSTONE.
+ */
+static inline bool is_common(const struct _pht_table *t, const void *p) {
+	return ((uintptr_t)p & t->common_mask) == t->common_bits
+		&& ((uintptr_t)p & ~t->common_mask) > TOMBSTONE;
+}
+
+
+/* extend @diffmask so that @p's bits outside of @mask & ~@diffmask won't
+ * look like 0 or TOMBSTONE, by de-commoning its lowest set bit above the
+ * latter.
+ */
+static inline uintptr_t valid_diffmask(
+	uintptr_t mask, uintptr_t diffmask, const void *p)
+{
+	if(((uintptr_t)p & ~(mask & ~diffmask)) <= TOMBSTONE) {
+		uintptr_t high = (uintptr_t)p & ~(uintptr_t)TOMBSTONE;
+		assert(high != 0);
+		diffmask |= high & -high;
+	}
+	return diffmask;
+}
+
+
+/* remove @diffmask from @t's common bits, taking the rest from @p, and pick a
+ * new perfect bit to match.
+ */
+static void drop_common(
+	struct _pht_table *t, uintptr_t diffmask, const void *p)
+{
+	t->common_mask &= ~diffmask;
+	t->common_bits = (uintptr_t)p & t->common_mask;
+
+	int pb = ffsl(t->common_mask & ~1ul) - 1;
+	t->perfect_bit = pb == 0 ? NO_PERFECT_BIT : pb - 1;
+	assert(t->common_mask & t_perfect_mask(t));
+}
+
+
 static struct _pht_table *update_common(
 	struct pht *ht, struct _pht_table *t, const void *p)
 {
 	assert((uintptr_t)p != TOMBSTONE);
-	if(ht->elems == 0) {
-		/* de-common exactly one set bit above TOMBSTONE, so that the sole
-		 * valid entry won't look like 0 or TOMBSTONE.
+	/* the very first item sets the common bits up from scratch, de-commoning
+	 * exactly one set bit above TOMBSTONE so that the sole valid entry won't
+	 * look like 0 or TOMBSTONE. later ones do the same when they differ from
+	 * the others only in bits that are already uncommon.
+	 */
+	uintptr_t mask = ht->elems == 0 ? ~0ul : t->common_mask,
+		diffmask = valid_diffmask(mask, ht->elems == 0 ? 0
+			: t->common_bits ^ (mask & (uintptr_t)p), p);
+	if(ht->elems == 0 && t->bits > 2) {
+		/* but @t keeps its size, as when it's from pht_reserve(), so rather
+		 * than have most of the items that follow replace it with another
+		 * just as large, keep only the run of equal high bits that @p starts
+		 * with in common. that tells e.g. user from kernel addresses, and
+		 * little else.
 		 */
-		int b = ffsl((uintptr_t)p & ~1ul) - 1;
-		assert(b >= 0);
-		t->common_mask = ~((uintptr_t)1 << b);
-		t->common_bits = (uintptr_t)p & t->common_mask;
+		uintptr_t lead = (intptr_t)p < 0 ? ~(uintptr_t)p : (uintptr_t)p;
+		int run = sizeof(uintptr_t) * CHAR_BIT == 32
+			? bitops_clz32(lead) : bitops_clz64(lead);
+		diffmask |= ~(uintptr_t)0 >> run;
+	}
 
-		/* this'd waste both space and scanning time when t->bits > 2, so
-		 * let's only waste space instead.
-		 */
-		assert(t->elems == 0);
-		t->bits = 2;
-	} else {
-		if(t->elems > 0) {
-			t = new_table(ht, t, true);
-			if(t == NULL) return NULL;
-		}
+	/* concurrent readers may be looking at @t even when it's empty, so its
+	 * common bits mustn't change under them. nor can a compact table take
+	 * on uncommon bits that don't fit.
+	 */
+	struct _pht_table *prev = NULL;
+	if(t->elems > 0 || (ht->flags & PHT_CONCURRENT_READ)
+		|| ((t->flags & COMPACT) && !fits_compact(mask & ~diffmask)))
+	{
+		prev = t;
+		/* never smaller than @prev, so as to not lose a pht_reserve(). */
+		t = alloc_table_room(ht, prev,
+			max(ht->elems * 2, t_max_elems(prev)), diffmask);
+		if(t == NULL) return NULL;
+	}
 
-		uintptr_t diffmask = t->common_bits ^ (t->common_mask & (uintptr_t)p);
-		t->common_mask &= ~diffmask;
-		t->common_bits = (uintptr_t)p & t->common_mask;
+	if(ht->elems == 0) {
+		t->common_mask = ~0ul;
+		assert(t->elems == 0);
 	}
+	drop_common(t, diffmask, p);
 	assert(((uintptr_t)p & ~t->common_mask) != 0
 		&& ((uintptr_t)p & ~t->common_mask) != TOMBSTONE);
+	assert(~t->flags & COMPACT || fits_compact(t->common_mask));
 
-	int pb = ffsl(t->common_mask & ~1ul) - 1;
-	t->perfect_bit = pb == 0 ? NO_PERFECT_BIT : pb - 1;
-	assert(t->common_mask & t_perfect_mask(t));
-
+	if(prev != NULL) replace_table(ht, t, prev, true);
 	return t;
 }
 
 
-/* table_add(), add to a table */
-static void table_add(struct _pht_table *t, size_t hash, const void *p)
+/* table_add() under ROBIN: an item farther from its home slot takes the slot
+ * of one that's closer to its own, which then carries on down the table in
+ * the same way. so perfect entries are only ever stored into empty slots,
+ * and a lookup may stop at the first one past its home slot.
+ */
+static void table_add_robin(
+	const struct pht *ht, struct _pht_table *t, size_t hash, const void *p,
+	uintptr_t val)
 {
-	assert(t->elems < (size_t)1 << t->bits);
 	uintptr_t perfect = t_perfect_mask(t),
 		e = stash_bits(t, hash) | ptr_to_entry(t, p);
-	size_t mask = ((size_t)1 << t->bits) - 1, i = t_bucket(t, hash);
-	if(is_valid(t->table[i]) && (~t->table[i] & perfect)) {
-		/* use an imperfect entry's slot to store @p perfectly, then
-		 * reinsert the previous item somewhere down the hash chain.
-		 */
-		uintptr_t olde = t->table[i];
-		t->table[i] = e | perfect;
-		e = olde;
-		perfect = 0;
-		i = (i + 1) & mask;
+	uint8_t c = ctrl_tag(hash);
+	size_t mask = ((size_t)1 << t->bits) - 1, i = t_bucket(t, hash), dist = 0;
+	for(; t_slot(t, i) != 0; i = (i + 1) & mask, dist++) {
+		/* the primary has no tombstones, see can_shift(). */
+		assert(t_slot(t, i) != TOMBSTONE);
+		size_t d = t_dist(ht, t, i);
+		if(d >= dist) continue;
+		uintptr_t cur = t_slot(t, i), cur_val = 0;
+		uint8_t cur_c = 0;
+		size_t cur_hash = 0;
+		if(t->flags & MAP) {
+			cur_val = t_vals(t)[i];
+			t_vals(t)[i] = val;
+		}
+		if(t->flags & HASHES) {
+			cur_hash = t_hashes(t)[i];
+			t_hashes(t)[i] = hash;
+		}
+		if(t->flags & CTRL) cur_c = t_ctrl(t)[i];
+		ctrl_set(t, i, c);
+		assert(dist > 0);
+		note_dist(t, dist);
+		slot_set(t, i, e);
+		e = cur & ~perfect;
+		val = cur_val;
+		hash = cur_hash;
+		c = cur_c;
+		dist = d;
 	}
-	while(is_valid(t->table[i])) {
-		i = (i + 1) & mask;
-		assert(i != t_bucket(t, hash));
-		perfect = 0;
+	if(dist == 0) e |= perfect;
+	if(t->flags & MAP) t_vals(t)[i] = val;
+	if(t->flags & HASHES) t_hashes(t)[i] = hash;
+	ctrl_set(t, i, c);
+	note_dist(t, dist);
+	slot_set(t, i, e);
+	t->elems++;
+}
+
+
+/* table_add(), add to a table */
+static void table_add(
+	const struct pht *ht, struct _pht_table *t, size_t hash, const void *p,
+	uintptr_t val)
+{
+	assert(t->elems < (size_t)1 << t->bits);
+	if(t->flags & ROBIN) {
+		table_add_robin(ht, t, hash, p, val);
+		return;
 	}
 
-	assert(t->table[i] <= 1);
-	assert(t->table[i] == 0 || t->deleted > 0);
-	t->deleted -= t->table[i];
+	uintptr_t perfect = t_perfect_mask(t),
+		e = stash_bits(t, hash) | ptr_to_entry(t, p);
+	size_t mask = ((size_t)1 << t->bits) - 1, home = t_bucket(t, hash),
+		bs = t_bucket_slots(t), i = home, j = home;
+	/* a free slot in the home bucket takes @p perfectly. failing that, the
+	 * first imperfect entry there will be bumped further down its hash chain
+	 * so that @p can be stored perfectly in its place.
+	 */
+	while(i - home < bs && is_valid(t_slot(t, i))) i++;
+	bool bump = false;
+	if(i - home == bs) {
+		while(j - home < bs && (t_slot(t, j) & perfect)) j++;
+		bump = j - home < bs;
+		i &= mask;
+		while(is_valid(t_slot(t, i))) {
+			i = (i + 1) & mask;
+			assert(i != home);
+		}
+	}
 
-	t->table[i] = e | perfect;
-	assert(is_valid(t->table[i]));
+	assert(t_slot(t, i) <= 1);
+	assert(t_slot(t, i) == 0 || t->deleted > 0);
+	t->deleted -= t_slot(t, i);
+
+	if(bump) {
+		/* copy before overwrite, so concurrent readers see it throughout. */
+		if(t->flags & MAP) t_vals(t)[i] = t_vals(t)[j];
+		if(t->flags & HASHES) t_hashes(t)[i] = t_hashes(t)[j];
+		if(t->flags & CTRL) ctrl_set(t, i, t_ctrl(t)[j]);
+		note_dist(t, run_dist(t, i));
+		slot_set(t, i, t_slot(t, j));
+		i = j;
+	}
+	if((i & ~(bs - 1)) == home) e |= perfect;
+	if(t->flags & MAP) t_vals(t)[i] = val;
+	if(t->flags & HASHES) t_hashes(t)[i] = hash;
+	ctrl_set(t, i, ctrl_tag(hash));
+	note_dist(t, (i - home) & mask);
+	slot_set(t, i, e);
+	assert(is_valid(t_slot(t, i)));
 	t->elems++;
 }
 
@@ -316,7 +1109,7 @@ static void table_add(struct _pht_table *t, size_t hash, const void *p)
  * must adjust @mig->elems when successful.
  */
 static bool fast_migrate(
-	struct _pht_table *t, struct _pht_table *mig, uintptr_t e)
+	struct _pht_table *t, struct _pht_table *mig, uintptr_t e, uintptr_t val)
 {
 	assert(t->elems < (size_t)1 << t->bits);
 	assert(t->nextmig == 0);
@@ -334,6 +1127,16 @@ static bool fast_migrate(
 	assert(t->perfect_bit == NO_PERFECT_BIT
 		|| t->perfect_bit == mig->perfect_bit
 		|| (~t->common_mask & t_perfect_mask(mig)));
+	/* a compact entry has lost the hash bits that a wider @t would stash
+	 * above the low 32.
+	 */
+	if((mig->flags & COMPACT) && (~t->flags & COMPACT)) return false;
+	/* nor is there a control byte to copy into @t from a classic table. */
+	if((t->flags & CTRL) && (~mig->flags & CTRL)) return false;
+	/* and the offset arithmetic below is for perfect items in a single home
+	 * slot, not a bucket, and knows nothing of ROBIN's order.
+	 */
+	if((t->flags | mig->flags) & (BUCKET | ROBIN)) return false;
 	size_t off = mig->nextmig - 1, t_mask = ((size_t)1 << t->bits) - 1;
 	uintptr_t perfect;
 	if(e & t_perfect_mask(mig)) {
@@ -359,8 +1162,9 @@ static bool fast_migrate(
 				 * all perfect items migrate without rehash even if that loses
 				 * perfect until next time.
 				 */
-				if(t->table[i] == 0) {
-					t->table[i] = TOMBSTONE;
+				if(t_slot(t, i) == 0) {
+					ctrl_set(t, i, TOMBSTONE);
+					slot_set(t, i, TOMBSTONE);
 					t->deleted++;
 				}
 			}
@@ -402,47 +1206,71 @@ static bool fast_migrate(
 
 	/* brekkie's up, ya slack cunt */
 	assert(off < (size_t)1 << t->bits);
-	e = (e & t->common_mask & ~t_perfect_mask(t))
+	e = (e & t_stash_mask(t))
 		| (((e & ~mig->common_mask) | mig->common_bits) & ~t->common_mask);
-	if(is_valid(t->table[off]) && (~t->table[off] & perfect)) {
+	assert(~e & t_perfect_mask(t));
+	size_t home = off;
+	bool bump = is_valid(t_slot(t, off)) && (~t_slot(t, off) & perfect);
+	if(bump) {
 		/* same bump logic as in table_add() */
-		assert(~t->table[off] & t_perfect_mask(t));
+		assert(~t_slot(t, off) & t_perfect_mask(t));
 		assert(perfect == t_perfect_mask(t));
-		uintptr_t olde = t->table[off];
-		t->table[off] = e | perfect;
-		e = olde;
-		perfect = 0;
 		off = (off + 1) & t_mask;
 	}
-	assert(~e & t_perfect_mask(t));
-	while(is_valid(t->table[off])) {
-		perfect = 0;
-		off = (off + 1) & t_mask;
+	while(is_valid(t_slot(t, off))) off = (off + 1) & t_mask;
+	t->deleted -= t_slot(t, off);
+	if(bump) {
+		if(t->flags & MAP) t_vals(t)[off] = t_vals(t)[home];
+		if(t->flags & HASHES) t_hashes(t)[off] = t_hashes(t)[home];
+		if(t->flags & CTRL) ctrl_set(t, off, t_ctrl(t)[home]);
+		note_dist(t, run_dist(t, off));
+		slot_set(t, off, t_slot(t, home));
+		off = home;
+		e |= perfect;
+	} else if(off == home) {
+		e |= perfect;
+	}
+	if(t->flags & MAP) t_vals(t)[off] = val;
+	if(t->flags & HASHES) {
+		t_hashes(t)[off] = t_hashes(mig)[mig->nextmig - 1];
 	}
-	t->deleted -= t->table[off];
-	t->table[off] = e | perfect;
+	if(t->flags & CTRL) ctrl_set(t, off, t_ctrl(mig)[mig->nextmig - 1]);
+	/* (only a perfect item's home is known here.) */
+	note_dist(t, perfect ? (off - home) & t_mask : run_dist(t, off));
+	slot_set(t, off, e);
 	t->elems++;
 
 	return true;
 }
 
 
-/* @mig is invalidated when @mig->elems == 1 before call. */
+/* returns false if the item needed a rehash, in which case it stays put
+ * when @fast_only. @mig is invalidated when @mig->elems == 1 before call.
+ */
 static bool mig_item(
 	struct pht *ht, struct _pht_table *t, struct _pht_table *mig,
 	uintptr_t e, bool fast_only)
 {
 	assert(is_valid(e));
-	bool fast = fast_migrate(t, mig, e);
+	assert(t_slot(mig, mig->nextmig - 1) == e);
+	uintptr_t val = mig->flags & MAP ? t_vals(mig)[mig->nextmig - 1] : 0;
+	bool fast = fast_migrate(t, mig, e, val);
 	if(!fast) {
-		if(fast_only) return false;
-		const void *m = entry_to_ptr(mig, e);
-		table_add(t, (*ht->rehash)(m, ht->priv), m);
+		/* (a stored hash is as good as a fast migration.) */
+		fast = mig->flags & HASHES;
+		if(fast_only && !fast) return false;
+		table_add(ht, t, item_hash(ht, mig, mig->nextmig - 1),
+			entry_to_ptr(mig, e), val);
 	}
 	if(unlikely(--mig->elems == 0)) {
 		/* dispose of old table. */
-		list_del_from(&ht->tables, &mig->link);
-		free(mig);
+		tables_del(ht, mig);
+		table_free(ht, mig);
+	} else {
+		/* @e is now in @t, so iteration may skip past it. */
+		__atomic_store_n(&mig->it_chain_start, mig->chain_start,
+			__ATOMIC_RELEASE);
+		__atomic_store_n(&mig->it_nextmig, mig->nextmig, __ATOMIC_RELEASE);
 	}
 	return fast;
 }
@@ -460,8 +1288,9 @@ static inline void mig_scan_item(
 		if(mig->flags & KEEP_CHAIN) {
 			assert(mig->bits >= t->bits);
 			size_t off = (mig->nextmig - 1) >> (mig->bits - t->bits);
-			if(t->table[off] == 0) {
-				t->table[off] = TOMBSTONE;
+			if(t_slot(t, off) == 0) {
+				ctrl_set(t, off, TOMBSTONE);
+				slot_set(t, off, TOMBSTONE);
 				t->deleted++;
 			}
 		}
@@ -479,7 +1308,7 @@ static void mig_step(struct pht *ht, struct _pht_table *t)
 	if(mig == t) return;
 	assert(mig->elems > 0);
 
-	if(mig->credit > 0 && ((uintptr_t)&mig->table[mig->nextmig] & 63) == 0) {
+	if(mig->credit > 0 && ((uintptr_t)slot_addr(mig, mig->nextmig) & 63) == 0) {
 		mig->credit--;
 		return;
 	}
@@ -490,7 +1319,7 @@ static void mig_step(struct pht *ht, struct _pht_table *t)
 	uintptr_t e;
 	do {
 		assert(mig->nextmig < (size_t)1 << mig->bits);
-		e = mig->table[mig->nextmig++];
+		e = t_slot(mig, mig->nextmig++);
 		mig_scan_item(t, mig, e);
 	} while(!is_valid(e));
 	size_t elems = mig->elems - 1;
@@ -501,13 +1330,13 @@ static void mig_step(struct pht *ht, struct _pht_table *t)
 	/* the second scan tries to finish the last cacheline touched, stopping
 	 * only if a second item requiring a rehash is found.
 	 */
-	ssize_t left = (64 - ((uintptr_t)&mig->table[mig->nextmig] & 63)) & 63;
+	ssize_t left = (64 - ((uintptr_t)slot_addr(mig, mig->nextmig) & 63)) & 63;
 	size_t lim = min((size_t)1 << mig->bits,
-		mig->nextmig + left / sizeof(uintptr_t));
+		mig->nextmig + left / t_slot_size(mig));
 	while(mig->nextmig < lim) {
-		e = mig->table[mig->nextmig++];
+		e = t_slot(mig, mig->nextmig++);
 		mig_scan_item(t, mig, e);
-		assert((left -= sizeof(uintptr_t), left >= 0));
+		assert((left -= t_slot_size(mig), left >= 0));
 		if(is_valid(e)) {
 			assert(elems == mig->elems);
 			if(!mig_item(ht, t, mig, e, rehashed)) {
@@ -525,11 +1354,122 @@ static void mig_step(struct pht *ht, struct _pht_table *t)
 }
 
 
-bool pht_add(struct pht *ht, size_t hash, const void *p)
+/* migrate at least @n items from the oldest subtables into @t, or all of
+ * them if there are fewer, with no limit on rehash calls. the last cacheline
+ * touched is finished like in mig_step(). returns the number of items moved.
+ */
+static size_t mig_chunk(struct pht *ht, struct _pht_table *t, size_t n)
+{
+	size_t moved = 0;
+	struct _pht_table *mig;
+	while(moved < n
+		&& (mig = list_tail(&ht->tables, struct _pht_table, link)) != t)
+	{
+		assert(mig->elems > 0);
+		for(;;) {
+			assert(mig->nextmig < (size_t)1 << mig->bits);
+			uintptr_t e = t_slot(mig, mig->nextmig++);
+			mig_scan_item(t, mig, e);
+			if(is_valid(e)) {
+				bool last = mig->elems == 1;
+				mig_item(ht, t, mig, e, false);
+				moved++;
+				if(last) break;
+			}
+			if(moved >= n
+				&& ((uintptr_t)slot_addr(mig, mig->nextmig) & 63) == 0)
+			{
+				break;
+			}
+		}
+	}
+	return moved;
+}
+
+
+static void table_del_shift(
+	const struct pht *ht, struct _pht_table *t, size_t i);
+
+
+/* under PHT_PURGE, remove one tombstone from the sole table @t in place,
+ * looking at most PURGE_STEP slots past where the last call left off. it's
+ * emptied like a deleted item under PHT_SHIFT_DEL, so that a table which
+ * churns at a constant size sheds its tombstones a few at a time instead of
+ * being replaced by a copy of itself once they fill it up. the shift walks
+ * to the end of the cluster, which PHT_PURGE implying HASHES keeps to a
+ * load per slot.
+ */
+static void purge_step(const struct pht *ht, struct _pht_table *t)
+{
+	assert(t == list_tail(&ht->tables, struct _pht_table, link));
+	assert(ht->flags & PHT_PURGE);
+	assert(~ht->flags & PHT_CONCURRENT_READ);
+	size_t mask = ((size_t)1 << t->bits) - 1;
+	/* (no empty slot for table_del_shift() to stop at, see can_shift().) */
+	if(t->elems + t->deleted > mask) return;
+	for(int n=0; n < PURGE_STEP && t->deleted > 0; n++) {
+		size_t i = t->purge;
+		t->purge = (i + 1) & mask;
+		if(t_slot(t, i) == TOMBSTONE) {
+			table_del_shift(ht, t, i);
+			t->deleted--;
+			break;
+		}
+	}
+}
+
+
+/* under PHT_FILTER, build secondaries' filters @budget slots at a time,
+ * newest first since it'll be migrated last. each item sets the one bit of
+ * its home bucket, from the slot for a perfect item and its hash otherwise.
+ * secondaries only lose items, so a filter is never updated after, and
+ * lookups only use it once it's complete.
+ */
+static void filter_step(struct pht *ht, size_t budget)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	while(budget > 0 && t != NULL
+		&& (t = list_next(&ht->tables, t, link)) != NULL)
+	{
+		size_t n = (size_t)1 << t->bits, bs = t_bucket_slots(t),
+			end = min(n, t->filter_next + budget);
+		if((~t->flags & FILTER) || t->filter_next == n) continue;
+		budget -= end - t->filter_next;
+		for(size_t i = t->filter_next; i < end; i++) {
+			uintptr_t e = t_slot(t, i);
+			if(!is_valid(e)) continue;
+			size_t home = e & t_perfect_mask(t) ? i & ~(bs - 1)
+				: t_bucket(t, item_hash(ht, t, i));
+			size_t bit = filter_bit(home, e & t_stash_mask(t));
+			t_filter(t)[bit >> 3] |= 1 << (bit & 7);
+		}
+		/* publishes the filter to concurrent readers once complete. */
+		__atomic_store_n(&t->filter_next, end, __ATOMIC_RELEASE);
+	}
+}
+
+
+bool pht_add(struct pht *ht, size_t hash, const void *p) {
+	return pht_add_val(ht, hash, p, 0);
+}
+
+
+bool pht_add_val(struct pht *ht, size_t hash, const void *p, uintptr_t val)
 {
 	if(unlikely(p == NULL)) return false;
 
 	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	/* start purging tombstones from a sole table halfway between where it
+	 * would grow and where they'd have it replaced, so that they're gone
+	 * before the latter. (any earlier and a table that's about to grow
+	 * anyway does the work for nothing.)
+	 */
+	if((ht->flags & PHT_PURGE) && t != NULL && t->deleted > 0
+		&& t->elems + 1 + t->deleted > (t_max_elems(t) + t_max_fill(t)) / 2
+		&& t == list_tail(&ht->tables, struct _pht_table, link))
+	{
+		purge_step(ht, t);
+	}
 	if(unlikely(t == NULL
 		|| t->elems + 1 > t_max_elems(t)
 		|| t->elems + 1 + t->deleted > t_max_fill(t)))
@@ -543,33 +1483,185 @@ bool pht_add(struct pht *ht, size_t hash, const void *p)
 
 		/* remove tombstones when fill condition was hit. */
 		t = new_table(ht, t,
-			t == NULL || t->elems + 1 + t->deleted <= t_max_fill(t));
+			t == NULL || t->elems + 1 + t->deleted <= t_max_fill(t), 0);
 		if(unlikely(t == NULL)) return false;
 	}
 	assert(t == list_top(&ht->tables, struct _pht_table, link));
 
-	if(((uintptr_t)p & t->common_mask) != t->common_bits) {
+	if(!is_common(t, p)) {
 		t = update_common(ht, t, p);
 		if(unlikely(t == NULL)) return false;
 	}
 
 	assert(p != NULL);
-	table_add(t, hash, p);
+	table_add(ht, t, hash, p, val);
 	ht->elems++;
 
 	mig_step(ht, t);
+	if(ht->flags & PHT_FILTER) filter_step(ht, FILTER_STEP);
+	reclaim(ht);
+	return true;
+}
+
+
+size_t pht_add_many(struct pht *ht, size_t n,
+	const size_t *hashes, const void *const *ptrs)
+{
+	size_t done = 0;
+	if(n > 0 && ht->elems == 0) {
+		/* the very first item sets up the common bits. */
+		if(!pht_add(ht, hashes[0], ptrs[0])) return 0;
+		done++;
+	}
+	size_t m = 0;
+	while(done + m < n && ptrs[done + m] != NULL) m++;
+	if(m == 0) return done;
+	hashes += done;
+	ptrs += done;
+
+	/* make room for the whole batch, and drop every common bit that any of
+	 * it disagrees with, in at most one new table.
+	 */
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	assert(t != NULL);
+	uintptr_t diffmask = 0;
+	for(size_t i=0; i < m; i++) {
+		diffmask |= t->common_bits ^ (t->common_mask & (uintptr_t)ptrs[i]);
+	}
+	for(size_t i=0; i < m; i++) {
+		diffmask = valid_diffmask(t->common_mask, diffmask, ptrs[i]);
+	}
+	bool fits_elems = t->elems + m <= t_max_elems(t),
+		fits_fill = t->elems + m + t->deleted <= t_max_fill(t);
+	if(!fits_elems || !fits_fill || (diffmask != 0
+		&& (t->elems > 0 || (ht->flags & PHT_CONCURRENT_READ)
+			|| ((t->flags & COMPACT)
+				&& !fits_compact(t->common_mask & ~diffmask)))))
+	{
+		struct _pht_table *prev = t;
+		/* (like update_common() when only the common bits changed.) */
+		t = alloc_table_room(ht, prev, max((ht->elems + m) * 2,
+			fits_elems && fits_fill ? t_max_elems(prev) : 0), diffmask);
+		if(unlikely(t == NULL)) return done;
+		if(diffmask != 0) drop_common(t, diffmask, ptrs[0]);
+		/* remove tombstones when only the fill condition was hit. */
+		replace_table(ht, t, prev, !fits_elems || fits_fill);
+	} else if(diffmask != 0) {
+		drop_common(t, diffmask, ptrs[0]);
+	}
+
+	size_t ahead = min_t(size_t, m, PREFETCH_AHEAD);
+	for(size_t i=0; i < ahead; i++) {
+		__builtin_prefetch(slot_addr(t, t_bucket(t, hashes[i])), 1);
+	}
+	for(size_t i=0; i < m; i++) {
+		if(i + ahead < m) {
+			__builtin_prefetch(slot_addr(t, t_bucket(t, hashes[i + ahead])),
+				1);
+		}
+		table_add(ht, t, hashes[i], ptrs[i], 0);
+	}
+	ht->elems += m;
+
+	/* migrate at the same rate as pht_add() would, but in one go. */
+	mig_chunk(ht, t, m);
+	if(ht->flags & PHT_FILTER) filter_step(ht, m * FILTER_STEP);
+	reclaim(ht);
+
+	return done + m;
+}
+
+
+bool pht_migrate(struct pht *ht, size_t budget)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link),
+		*mig;
+	if(t == NULL) return true;
+	for(; budget > 0
+		&& (mig = list_tail(&ht->tables, struct _pht_table, link)) != t;
+		budget--)
+	{
+		assert(mig->elems > 0);
+		assert(mig->nextmig < (size_t)1 << mig->bits);
+		uintptr_t e = t_slot(mig, mig->nextmig++);
+		mig_scan_item(t, mig, e);
+		if(is_valid(e)) mig_item(ht, t, mig, e, false);
+	}
+	reclaim(ht);
+	return list_tail(&ht->tables, struct _pht_table, link) == t;
+}
+
+
+void pht_finish_migration(struct pht *ht) {
+	pht_migrate(ht, SIZE_MAX);
+}
+
+
+bool pht_reserve(struct pht *ht, size_t n)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	n = max(n, ht->elems);
+	if(t != NULL && t_max_elems(t) >= n) {
+		pht_finish_migration(ht);
+		return true;
+	}
+
+	/* with nothing to take common bits from, the first item sets them up in
+	 * @nt as per update_common(). most of those past bit 31 stay uncommon
+	 * there, so don't count on compact slots.
+	 */
+	struct _pht_table *nt = alloc_table_room(ht,
+		ht->elems > 0 ? t : NULL, n, ht->elems > 0 ? 0 : ~0ul);
+	if(nt == NULL) return false;
+	if(t == NULL) link_table(ht, nt, NULL, false);
+	else replace_table(ht, nt, t, false);
+	pht_finish_migration(ht);
 	return true;
 }
 
 
+/* bounded migration on behalf of something other than pht_add(), per
+ * PHT_MIG_ON_DEL and PHT_MIG_ON_GET.
+ */
+static void mig_other(struct pht *ht)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	if(t == NULL) return;
+	mig_step(ht, t);
+	reclaim(ht);
+}
+
+
+/* per pht_opts.shrink, replace a sparse primary with one that's at most half
+ * its size once previous migration has finished. tombstones aren't carried
+ * over.
+ */
+static void maybe_shrink(struct pht *ht)
+{
+	struct _pht_table *t = list_top(&ht->tables, struct _pht_table, link);
+	if(t == NULL || list_tail(&ht->tables, struct _pht_table, link) != t
+		|| t->elems * ht->shrink >= (size_t)1 << t->bits
+		|| room_bits(ht->elems * 2) >= t->bits)
+	{
+		return;
+	}
+	struct _pht_table *nt = alloc_table(ht, t, 0);
+	if(nt != NULL) replace_table(ht, nt, t, false);
+}
+
+
+static void *firstval(const struct pht *ht, struct pht_iter *it, size_t hash);
+
+
 bool pht_del(struct pht *ht, size_t hash, const void *p)
 {
 	struct pht_iter it;
-	for(void *cand = pht_firstval(ht, &it, hash);
+	for(void *cand = firstval(ht, &it, hash);
 		cand != NULL; cand = pht_nextval(ht, &it, hash))
 	{
 		if(cand == (void *)p) {
 			pht_delval(ht, &it);
+			if(ht->flags & PHT_MIG_ON_DEL) mig_other(ht);
 			return true;
 		}
 	}
@@ -592,83 +1684,312 @@ bool pht_del(struct pht *ht, size_t hash, const void *p)
 
 bool pht_copy(struct pht *dst, const struct pht *src)
 {
-	pht_init(dst, src->rehash, src->priv);
-	/* when in doubt, use brute force. it'd be much quicker to complete all
-	 * migration in @src and then memdup the resulting primary, but this one
-	 * is simpler at the cost of forming fresh hash chains in the destination
-	 * and using more memory.
+	pht_init_opts(dst, src->rehash, src->priv, &(struct pht_opts){
+		.flags = src->flags, .shrink = src->shrink, .alloc = src->alloc,
+		.cache_max = src->cache_max });
+	/* duplicate every table as it is, migration state and all, so that
+	 * nothing is rehashed and @dst carries on migrating where @src was.
 	 */
-	struct pht_iter it;
-	for(void *ptr = pht_first(src, &it);
-		ptr != NULL; ptr = pht_next(src, &it))
-	{
-		bool ok = pht_add(dst, (*src->rehash)(ptr, src->priv), ptr);
-		if(!ok) {
+	const struct _pht_table *t;
+	list_for_each(&src->tables, t, link) {
+		size_t sz = t_bytes(t);
+		struct _pht_table *nt = alloc_zeroed(dst, sz);
+		if(nt == NULL) {
 			pht_clear(dst);
 			return false;
 		}
+		memcpy(nt, t, sz);
+		nt->limbo = NULL;
+		nt->retired = 0;
+		list_add_tail(&dst->tables, &nt->link);
 	}
+	dst->elems = src->elems;
 	return true;
 }
 
 
+/* the table after @t in iteration order, or the first one when @t is NULL.
+ * usually the primary comes first since it has most of the items, but under
+ * PHT_CONCURRENT_READ iteration starts from the oldest table instead: as
+ * migration only moves items towards the primary, a reader that misses an
+ * item where it was will find it where it went.
+ */
+static inline struct _pht_table *it_next_table(
+	const struct pht *ht, const struct _pht_table *t)
+{
+	if(~ht->flags & PHT_CONCURRENT_READ) {
+		return t == NULL ? list_top(&ht->tables, struct _pht_table, link)
+			: list_next(&ht->tables, (struct _pht_table *)t, link);
+	} else {
+		/* list_tail() and list_prev(), paired with tables_add() and
+		 * tables_del().
+		 */
+		struct list_node *n = __atomic_load_n(
+			t == NULL ? &ht->tables.n.prev : &t->link.prev, __ATOMIC_ACQUIRE);
+		return n == &ht->tables.n ? NULL
+			: list_entry(n, struct _pht_table, link);
+	}
+}
+
+
 static bool table_next(
 	const struct pht *ht, struct pht_iter *it, size_t hash,
 	uintptr_t *perfect)
 {
-	it->t = list_next(&ht->tables, it->t, link);
+	it->t = it_next_table(ht, it->t);
 	if(it->t == NULL) return false;
+	if(filter_skip(it->t, hash)) return table_next(ht, it, hash, perfect);
 
 	assert(it->hash == hash);
-	size_t first = t_bucket(it->t, hash);
-	if(first >= it->t->nextmig) {
+	size_t first = t_bucket(it->t, hash), nextmig = t_nextmig(it->t);
+	if(first >= nextmig) {
 		it->off = first;
 		it->last = first;
 		*perfect = t_perfect_mask(it->t);
-	} else if(first < it->t->chain_start) {
+	} else if(first < t_chain_start(it->t)) {
 		/* first is in an already-migrated chain; skip table. */
 		return table_next(ht, it, hash, perfect);
 	} else {
 		/* would've started in the migration zone within the existing hash
 		 * chain; skip to nextmig and clear perfect.
 		 */
-		it->off = it->t->nextmig;
+		it->off = nextmig;
 		it->last = 0;
-		*perfect = 0;
+		*perfect = (it->t->flags & BUCKET) && t_in_home(it->t, nextmig, hash)
+			? t_perfect_mask(it->t) : 0;
 	}
 
-	assert(it->off >= it->t->nextmig);
 	return true;
 }
 
 
-static void *table_val(
-	const struct pht *ht, struct pht_iter *it,
-	size_t hash, uintptr_t perfect)
+/* probe_group() examines PROBE_WIDTH consecutive slots at once, returning a
+ * bitmask of the empty ones and setting *@cands to a bitmask of the valid
+ * ones where (e & @mask) == @extra. bit i stands for @base[i].
+ */
+#if UINTPTR_MAX == UINT64_MAX && defined(__AVX2__)
+#define PROBE_WIDTH 4
+
+static inline unsigned probe_group(
+	unsigned *cands, const uintptr_t *base, uintptr_t mask, uintptr_t extra)
+{
+	__m256i e = _mm256_loadu_si256((const __m256i *)base),
+		empty = _mm256_cmpeq_epi64(e, _mm256_setzero_si256()),
+		invalid = _mm256_or_si256(empty,
+			_mm256_cmpeq_epi64(e, _mm256_set1_epi64x(TOMBSTONE))),
+		match = _mm256_cmpeq_epi64(
+			_mm256_and_si256(e, _mm256_set1_epi64x(mask)),
+			_mm256_set1_epi64x(extra));
+	*cands = _mm256_movemask_pd(
+		_mm256_castsi256_pd(_mm256_andnot_si256(invalid, match)));
+	return _mm256_movemask_pd(_mm256_castsi256_pd(empty));
+}
+
+
+/* the same for COMPACT slots, twice as many at once. */
+#define PROBE_WIDTH32 8
+
+static inline unsigned probe_group32(
+	unsigned *cands, const uint32_t *base, uint32_t mask, uint32_t extra)
+{
+	__m256i e = _mm256_loadu_si256((const __m256i *)base),
+		empty = _mm256_cmpeq_epi32(e, _mm256_setzero_si256()),
+		invalid = _mm256_or_si256(empty,
+			_mm256_cmpeq_epi32(e, _mm256_set1_epi32(TOMBSTONE))),
+		match = _mm256_cmpeq_epi32(
+			_mm256_and_si256(e, _mm256_set1_epi32(mask)),
+			_mm256_set1_epi32(extra));
+	*cands = _mm256_movemask_ps(
+		_mm256_castsi256_ps(_mm256_andnot_si256(invalid, match)));
+	return _mm256_movemask_ps(_mm256_castsi256_ps(empty));
+}
+
+#elif UINTPTR_MAX == UINT64_MAX && defined(__SSE2__)
+#define PROBE_WIDTH 4
+
+/* SSE2 has no 64-bit compare, so combine the two 32-bit halves. */
+static inline __m128i cmpeq64(__m128i a, __m128i b) {
+	__m128i c = _mm_cmpeq_epi32(a, b);
+	return _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+
+static inline unsigned probe_pair(
+	unsigned *cands, const uintptr_t *base, __m128i mask, __m128i extra)
+{
+	__m128i e = _mm_loadu_si128((const __m128i *)base),
+		empty = cmpeq64(e, _mm_setzero_si128()),
+		invalid = _mm_or_si128(empty,
+			cmpeq64(e, _mm_set1_epi64x(TOMBSTONE))),
+		match = cmpeq64(_mm_and_si128(e, mask), extra);
+	*cands = _mm_movemask_pd(_mm_castsi128_pd(_mm_andnot_si128(invalid, match)));
+	return _mm_movemask_pd(_mm_castsi128_pd(empty));
+}
+
+
+static inline unsigned probe_group(
+	unsigned *cands, const uintptr_t *base, uintptr_t mask, uintptr_t extra)
+{
+	__m128i m = _mm_set1_epi64x(mask), x = _mm_set1_epi64x(extra);
+	unsigned lo_c, hi_c,
+		lo_e = probe_pair(&lo_c, base, m, x),
+		hi_e = probe_pair(&hi_c, base + 2, m, x);
+	*cands = lo_c | hi_c << 2;
+	return lo_e | hi_e << 2;
+}
+
+
+#define PROBE_WIDTH32 4
+
+static inline unsigned probe_group32(
+	unsigned *cands, const uint32_t *base, uint32_t mask, uint32_t extra)
+{
+	__m128i e = _mm_loadu_si128((const __m128i *)base),
+		empty = _mm_cmpeq_epi32(e, _mm_setzero_si128()),
+		invalid = _mm_or_si128(empty,
+			_mm_cmpeq_epi32(e, _mm_set1_epi32(TOMBSTONE))),
+		match = _mm_cmpeq_epi32(_mm_and_si128(e, _mm_set1_epi32(mask)),
+			_mm_set1_epi32(extra));
+	*cands = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(invalid, match)));
+	return _mm_movemask_ps(_mm_castsi128_ps(empty));
+}
+#endif
+
+
+#ifdef PROBE_WIDTH
+/* the same for CTRL tables, by control bytes. candidates are the slots
+ * tagged with @tag, and need their entries checked as well.
+ */
+#define PROBE_WIDTH8 16
+
+static inline unsigned probe_ctrl(
+	unsigned *cands, const uint8_t *base, uint8_t tag)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)base);
+	*cands = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(tag)));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_setzero_si128()));
+}
+#endif
+
+
+/* table_val() within @it->t for CTRL tables outside of ROBIN, which probe
+ * by control bytes alone: the probe ends at an empty one, and only slots
+ * tagged for @hash are loaded. whether a candidate's entry should be perfect
+ * follows from where it is. returns NULL at the end of the probe.
+ */
+static void *table_val_ctrl(struct pht_iter *it, size_t hash)
+{
+	const struct _pht_table *t = it->t;
+	const uint8_t *ctrl = t_ctrl(t);
+	uint8_t tag = ctrl_tag(hash);
+	size_t off = it->off, mask = ((size_t)1 << t->bits) - 1,
+		home = t_bucket(t, hash);
+	uintptr_t stash = stash_bits(t, hash), perfect = t_perfect_mask(t);
+	if(t->flags & MAP) __builtin_prefetch(&t_vals(t)[off]);
+	do {
+#ifdef PROBE_WIDTH
+		if(off + PROBE_WIDTH8 <= mask + 1 && it->last - off >= PROBE_WIDTH8) {
+			/* as in table_val(), skip up to a group's first candidate or
+			 * empty byte, or to its last if there's neither.
+			 */
+			unsigned cands, empty = probe_ctrl(&cands, &ctrl[off], tag);
+			off += (cands | empty) != 0 ? __builtin_ctz(cands | empty)
+				: PROBE_WIDTH8 - 1;
+		}
+#endif
+		uint8_t c = __atomic_load_n(&ctrl[off], __ATOMIC_ACQUIRE);
+		if(c == 0) break;
+		if(c == tag) {
+			uintptr_t e = slot_get(t, off);
+			if(is_valid(e) && (e & t->common_mask)
+				== (t_in_home(t, off, hash) ? stash | perfect : stash))
+			{
+				it->off = off;
+				return entry_to_ptr(t, e);
+			}
+		}
+		off = (off + 1) & mask;
+		if(off == 0 && off != it->last) {
+			size_t nextmig = t_nextmig(t);
+			if(t_chain_start(t) > 0 || it->last <= nextmig) break;
+			off = nextmig;
+		}
+		if(((off - home) & mask) > t_max_dist(t)) break;
+	} while(off != it->last);
+	return NULL;
+}
+
+
+/* the same for other tables, by slots. */
+static void *table_val_slots(
+	struct pht_iter *it, size_t hash, uintptr_t perfect)
 {
-	assert(it->t != NULL);
-	assert(it->hash == hash);
 	const struct _pht_table *t = it->t;
-	size_t off = it->off;
+	size_t off = it->off, mask = ((size_t)1 << t->bits) - 1,
+		home = t_bucket(t, hash);
 	uintptr_t extra = stash_bits(it->t, hash) | perfect;
-	assert(off >= t->nextmig);
+	/* so that a hit's value word arrives alongside its slot. */
+	if(t->flags & MAP) __builtin_prefetch(&t_vals(t)[off]);
 	do {
-		if(is_valid(t->table[off])
-			&& (t->table[off] & t->common_mask) == extra)
+#ifdef PROBE_WIDTH
+		size_t width = t->flags & COMPACT ? PROBE_WIDTH32 : PROBE_WIDTH;
+		size_t bs = t_bucket_slots(t);
+		if(((extra & perfect) == 0 || (off & (bs - 1)) + width <= bs)
+			&& off + width <= mask + 1 && it->last - off >= width
+			&& (~t->flags & ROBIN))
 		{
+			/* a group past the home slot, or within the home bucket, that
+			 * neither wraps around nor reaches it->last is skipped up to its
+			 * first candidate or empty slot, or to its last slot if there's
+			 * neither, which is then examined below. (the slot is loaded
+			 * again so that a concurrent writer can't slip a tombstone in
+			 * between.) ROBIN tables probe one slot at a time instead, so as
+			 * to stop early as below.
+			 */
+			unsigned cands, empty = t->flags & COMPACT
+				? probe_group32(&cands, (const uint32_t *)t->table + off,
+					t->common_mask, extra)
+				: probe_group(&cands, &t->table[off], t->common_mask, extra);
+			off += (cands | empty) != 0 ? __builtin_ctz(cands | empty)
+				: width - 1;
+		}
+#endif
+		uintptr_t e = slot_get(t, off);
+		if(is_valid(e) && (e & t->common_mask) == extra) {
 			it->off = off;
-			return entry_to_ptr(t, t->table[off]);
+			return entry_to_ptr(t, e);
 		}
-		if(t->table[off] == 0) break;
-		extra &= ~perfect;
-		off = (off + 1) & (((size_t)1 << t->bits) - 1);
+		if(e == 0) break;
+		/* past the home slot, a perfect entry under ROBIN is where @hash's
+		 * item would've been stored ahead of.
+		 */
+		if((t->flags & ROBIN) && (e & t_perfect_mask(t) & ~extra)) break;
+		off = (off + 1) & mask;
+		if((off & (t_bucket_slots(t) - 1)) == 0) extra &= ~perfect;
 		if(off == 0 && off != it->last) {
-			if(t->chain_start > 0) break;
-			off = t->nextmig;
+			/* (concurrent migration may also have passed it->last.) */
+			size_t nextmig = t_nextmig(t);
+			if(t_chain_start(t) > 0 || it->last <= nextmig) break;
+			off = nextmig;
 		}
+		/* nothing of @hash's is stored farther from home. */
+		if(((off - home) & mask) > t_max_dist(t)) break;
 	} while(off != it->last);
+	return NULL;
+}
 
-	if(table_next(ht, it, hash, &perfect)) {
+
+static void *table_val(
+	const struct pht *ht, struct pht_iter *it,
+	size_t hash, uintptr_t perfect)
+{
+	assert(it->t != NULL);
+	assert(it->hash == hash);
+	void *p = (it->t->flags & CTRL) && (~it->t->flags & ROBIN)
+		? table_val_ctrl(it, hash) : table_val_slots(it, hash, perfect);
+	if(p != NULL) {
+		return p;
+	} else if(table_next(ht, it, hash, &perfect)) {
 		return table_val(ht, it, hash, perfect);
 	} else {
 		/* done. */
@@ -678,43 +1999,156 @@ static void *table_val(
 }
 
 
+static void *firstval(const struct pht *ht, struct pht_iter *it, size_t hash)
+{
+	uintptr_t perfect;
+	it->t = NULL;
+	it->hash = hash;
+	if(unlikely(!table_next(ht, it, hash, &perfect))) return NULL;
+	return table_val(ht, it, hash, perfect);
+}
+
+
 void *pht_firstval(const struct pht *ht, struct pht_iter *it, size_t hash)
 {
-	it->t = list_top(&ht->tables, struct _pht_table, link);
-	if(unlikely(it->t == NULL)) return NULL;
-	assert(it->t->nextmig == 0);
+	/* (as documented, the caller knows that @ht isn't really const.) */
+	if(unlikely(ht->flags & PHT_MIG_ON_GET)) mig_other((struct pht *)ht);
+	return firstval(ht, it, hash);
+}
 
-	it->off = t_bucket(it->t, hash);
-	it->last = it->off;
-	it->hash = hash;
-	return table_val(ht, it, hash, t_perfect_mask(it->t));
+
+size_t pht_ntables_for(const struct pht *ht, size_t hash)
+{
+	struct pht_iter it = { .t = NULL, .hash = hash };
+	uintptr_t perfect;
+	size_t n = 0;
+	while(table_next(ht, &it, hash, &perfect)) n++;
+	return n;
 }
 
 
 void *pht_nextval(const struct pht *ht, struct pht_iter *it, size_t hash)
 {
 	if(it->t == NULL) return NULL;
-	it->off = (it->off + 1) & (((size_t)1 << it->t->bits) - 1);
+	size_t mask = ((size_t)1 << it->t->bits) - 1;
+	it->off = (it->off + 1) & mask;
 	uintptr_t perf = 0;
+	size_t nextmig = t_nextmig(it->t);
 	if(it->off == it->last
-		|| (it->off == 0 && it->t->chain_start > 0)
-		|| (it->off == 0 && it->last <= it->t->nextmig))
+		|| (it->off == 0 && t_chain_start(it->t) > 0)
+		|| (it->off == 0 && it->last <= nextmig)
+		|| ((it->off - t_bucket(it->t, hash)) & mask) > t_max_dist(it->t))
 	{
 		/* end of probe */
 		if(!table_next(ht, it, hash, &perf)) return NULL;
-	} else if(it->off == 0) {
-		/* wrap around */
-		it->off = it->t->nextmig;
+	} else {
+		if(it->off == 0) it->off = nextmig;	/* wrap around */
+		/* (only in a bucket, or after table_del_shift().) */
+		if(t_in_home(it->t, it->off, hash)) perf = t_perfect_mask(it->t);
 	}
 	return table_val(ht, it, hash, perf);
 }
 
 
+/* touch the slot where pht_firstval() would start probing for @hash in each
+ * table, skipping tables where table_next() would. (tables are walked as by
+ * table_next() as well, for PHT_CONCURRENT_READ.)
+ */
+static inline void prefetch_val(const struct pht *ht, size_t hash)
+{
+	for(const struct _pht_table *t = it_next_table(ht, NULL);
+		t != NULL; t = it_next_table(ht, t))
+	{
+		size_t first = t_bucket(t, hash), nextmig = t_nextmig(t);
+		if(first >= nextmig) {
+			__builtin_prefetch(slot_addr(t, first));
+			if(t->flags & CTRL) __builtin_prefetch(&t_ctrl(t)[first]);
+		} else if(first >= t_chain_start(t)) {
+			__builtin_prefetch(slot_addr(t, nextmig));
+		}
+	}
+}
+
+
+size_t pht_get_many(const struct pht *ht, size_t n,
+	const size_t *hashes, bool (*cmp)(const void *cand, void *ptr),
+	const void *const *keys, void **out)
+{
+	if(unlikely(list_empty(&ht->tables))) {
+		for(size_t i=0; i < n; i++) out[i] = NULL;
+		return 0;
+	}
+
+	size_t found = 0, ahead = min_t(size_t, n, PREFETCH_AHEAD);
+	for(size_t i=0; i < ahead; i++) prefetch_val(ht, hashes[i]);
+	for(size_t i=0; i < n; i++) {
+		if(i + ahead < n) prefetch_val(ht, hashes[i + ahead]);
+		out[i] = pht_get(ht, hashes[i], cmp, keys[i]);
+		if(out[i] != NULL) found++;
+	}
+	return found;
+}
+
+
+/* true when pht_delval() may empty a slot of @t with table_del_shift()
+ * rather than leave a tombstone. only the primary qualifies, since migration
+ * goes through a secondary's slots in order, and outside of ROBIN only while
+ * it's the sole table, since fast_migrate() relies on the primary's chains
+ * staying put while migration is under way. the tombstones that it leaves
+ * may also have taken every empty slot, in which case there's nowhere for
+ * table_del_shift() to stop. (@t->elems already excludes the item deleted.)
+ * both flags that get here imply HASHES, so the walk reads the hash of each
+ * item it passes rather than calling ht->rehash.
+ */
+static bool can_shift(const struct pht *ht, const struct _pht_table *t)
+{
+	return t == list_top(&ht->tables, struct _pht_table, link)
+		&& ((t->flags & ROBIN) || ((ht->flags & PHT_SHIFT_DEL)
+			&& t == list_tail(&ht->tables, struct _pht_table, link)
+			&& t->elems + 1 + t->deleted < (size_t)1 << t->bits));
+}
+
+
+/* empty slot @i of @t, moving later items of its cluster back into the hole
+ * whenever their home is at or before it, until an empty slot is reached.
+ * tombstones are moved back as well, as they may hold a chain together.
+ * under ROBIN that's the same as shifting the cluster back by one up to the
+ * first perfect entry, which keeps chains sorted by distance.
+ */
+static void table_del_shift(
+	const struct pht *ht, struct _pht_table *t, size_t i)
+{
+	size_t mask = ((size_t)1 << t->bits) - 1, bs = t_bucket_slots(t), j = i;
+	uintptr_t perfect = t_perfect_mask(t), e;
+	while(e = t_slot(t, j = (j + 1) & mask), e != 0) {
+		size_t home = e == TOMBSTONE ? i
+			: e & perfect ? j & ~(bs - 1)
+			: t_bucket(t, item_hash(ht, t, j));
+		if(((j - home) & mask) < ((j - i) & mask)) {
+			/* home is past the hole. */
+			if(t->flags & ROBIN) break;
+			continue;
+		}
+		if(e != TOMBSTONE) {
+			e &= ~perfect;
+			if((i & ~(bs - 1)) == home) e |= perfect;
+		}
+		if(t->flags & MAP) t_vals(t)[i] = t_vals(t)[j];
+		if(t->flags & HASHES) t_hashes(t)[i] = t_hashes(t)[j];
+		if(t->flags & CTRL) ctrl_set(t, i, t_ctrl(t)[j]);
+		slot_set(t, i, e);
+		i = j;
+	}
+	ctrl_set(t, i, 0);
+	slot_set(t, i, 0);
+}
+
+
 void pht_delval(struct pht *ht, struct pht_iter *it)
 {
 	assert(it->t != NULL);
 	assert(it->t->elems > 0);
-	assert(is_valid(it->t->table[it->off]));
+	assert(is_valid(t_slot(it->t, it->off)));
 
 	ht->elems--;
 	if(unlikely(--it->t->elems == 0)
@@ -726,23 +2160,44 @@ void pht_delval(struct pht *ht, struct pht_iter *it)
 		 */
 		struct _pht_table *dead = it->t;
 		table_next(ht, it, it->hash, &(uintptr_t){ 0 });
-		list_del_from(&ht->tables, &dead->link);
-		free(dead);
+		tables_del(ht, dead);
+		table_free(ht, dead);
+	} else if(can_shift(ht, it->t)) {
+		size_t mask = ((size_t)1 << it->t->bits) - 1;
+		table_del_shift(ht, it->t, it->off);
+		/* pht_nextval() resumes with what was shifted into it->off. */
+		if(it->off == it->last) it->last = (it->last - 1) & mask;
+		it->off = (it->off - 1) & mask;
 	} else {
-		it->t->table[it->off] = TOMBSTONE;
+		ctrl_set(it->t, it->off, TOMBSTONE);
+		slot_set(it->t, it->off, TOMBSTONE);
 		it->t->deleted++;
 	}
+	/* (a smaller primary leaves @it where it was, with nothing in it to
+	 * visit.)
+	 */
+	if(ht->shrink > 0) maybe_shrink(ht);
+	reclaim(ht);
+}
+
+
+uintptr_t *pht_iter_val(const struct pht *ht, const struct pht_iter *it)
+{
+	assert(ht->flags & PHT_MAP);
+	assert(it->t != NULL);
+	assert(is_valid(t_slot(it->t, it->off)));
+	return &t_vals(it->t)[it->off];
 }
 
 
 static bool table_next_all(const struct pht *ht, struct pht_iter *it)
 {
-	it->t = list_next(&ht->tables, it->t, link);
+	it->t = it_next_table(ht, it->t);
 	if(it->t == NULL) return false;
 
 	assert(it->last == 0);
 	assert(it->hash == 0);
-	it->off = it->t->nextmig;
+	it->off = t_nextmig(it->t);
 	return true;
 }
 
@@ -750,25 +2205,23 @@ static bool table_next_all(const struct pht *ht, struct pht_iter *it)
 static void *table_val_all(const struct pht *ht, struct pht_iter *it)
 {
 	assert(it->t != NULL);
-	size_t off = it->off, last = (size_t)1 << it->t->bits;
-	do {
-		if(is_valid(it->t->table[off])) {
+	size_t last = (size_t)1 << it->t->bits;
+	for(size_t off = it->off; off < last; off++) {
+		uintptr_t e = slot_get(it->t, off);
+		if(is_valid(e)) {
 			it->off = off;
-			return entry_to_ptr(it->t, it->t->table[off]);
+			return entry_to_ptr(it->t, e);
 		}
-	} while(++off != last);
+	}
 	return table_next_all(ht, it) ? table_val_all(ht, it) : NULL;
 }
 
 
 void *pht_first(const struct pht *ht, struct pht_iter *it)
 {
-	it->t = list_top(&ht->tables, struct _pht_table, link);
-	if(unlikely(it->t == NULL)) return NULL;
-	assert(it->t->nextmig == 0);
-
+	it->t = NULL;
 	it->off = 0; it->last = 0; it->hash = 0;
-	return table_val_all(ht, it);
+	return table_next_all(ht, it) ? table_val_all(ht, it) : NULL;
 }
 
 
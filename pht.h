@@ -7,18 +7,118 @@
 #define _PHT_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <ccan/list/list.h>
 
 
 struct _pht_table;
 
+/* flags for struct pht_opts */
+#define PHT_CONCURRENT_READ 1	/* lock-free readers, see pht_read_enter() */
+/* migrate in pht_del() and pht_firstval() as well, at most as much per call
+ * as pht_add() does, so that secondary tables don't outlive a growth spurt
+ * in delete-heavy or read-mostly use. the latter modifies @ht through a
+ * const pointer, so lookups invalidate iterators the same way as
+ * pht_add(), and it can't be combined with PHT_CONCURRENT_READ.
+ */
+#define PHT_MIG_ON_DEL 2
+#define PHT_MIG_ON_GET 4
+/* each item carries a uintptr_t value word, set by pht_add_val() and reached
+ * through pht_iter_val(). migration moves it along with the item. not
+ * combinable with PHT_CONCURRENT_READ.
+ */
+#define PHT_MAP 8
+/* tables of 64k slots and up keep a control byte per slot next to the
+ * slots, tagged with 7 bits of the hash, so that lookups probe 16 slots at a
+ * time by their control bytes and load only the candidate entries. costs
+ * one byte per slot.
+ */
+#define PHT_CTRL 16
+/* slots are grouped into buckets of a cacheline's worth, which are filled
+ * before probing overflows into the next, so that most lookups touch a
+ * single line even at high fill.
+ */
+#define PHT_BUCKET 32
+/* Robin Hood insertion: an item farther from its home slot displaces one
+ * that's closer to its own, which bounds probe lengths tightly and lets
+ * lookups give up early. deletion from the primary table shifts the rest of
+ * the cluster back instead of leaving a tombstone. both need the hash of
+ * every item they move past, so this implies PHT_STORE_HASH. doesn't
+ * combine with PHT_CONCURRENT_READ or PHT_BUCKET.
+ */
+#define PHT_ROBIN_HOOD 64
+/* pht_del() and pht_delval() empty the slot outright while there's just
+ * the one table, moving later items of the cluster back towards their home
+ * slots, so that churn at a constant size doesn't fill the table with
+ * tombstones and force a rebuild. that needs the hash of every item passed,
+ * so this implies PHT_STORE_HASH. not combinable with PHT_CONCURRENT_READ.
+ */
+#define PHT_SHIFT_DEL 128
+/* pht_add() empties a few tombstones of a sole table in place as it nears
+ * its fill limit, the same way as PHT_SHIFT_DEL, so that churn at a
+ * constant size reuses the table instead of having it replaced by a fresh
+ * copy. each one walks the rest of its cluster, reading the hash of every
+ * item passed, so this implies PHT_STORE_HASH. not combinable with
+ * PHT_CONCURRENT_READ.
+ */
+#define PHT_PURGE 256
+/* each table carries a filter of 4 bits per slot, which is built a little
+ * per item added once it's become a secondary, so that lookups that miss
+ * during growth may skip it without probing. building it costs a rehash
+ * per item away from home, or none with PHT_STORE_HASH.
+ */
+#define PHT_FILTER 512
+/* each table keeps every item's hash in a parallel array, so that
+ * migration, PHT_ROBIN_HOOD, PHT_SHIFT_DEL and pht_check() never call
+ * @rehash. costs a size_t per slot.
+ */
+#define PHT_STORE_HASH 1024
+
+/* where tables come from. alloc_zeroed() returns @size bytes of zeroes
+ * aligned to 64 bytes, i.e. a cacheline, or NULL on failure, and free() gets
+ * back the same @size. both get @priv.
+ */
+struct pht_alloc {
+	void *(*alloc_zeroed)(size_t size, void *priv);
+	void (*free)(void *ptr, size_t size, void *priv);
+	void *priv;
+};
+
+struct pht_opts {
+	unsigned flags;
+	const struct pht_alloc *alloc;	/* NULL for calloc() and free() */
+	/* up to this many bytes of retired tables are kept around for reuse
+	 * instead of freed. 0 for none.
+	 */
+	size_t cache_max;
+	/* when nonzero, pht_del() and pht_delval() replace a primary table
+	 * that's less than 1/@shrink full with a smaller one, and the former
+	 * migrates into it the same way as with PHT_MIG_ON_DEL, which this
+	 * implies. 16 is a fine choice.
+	 */
+	unsigned shrink;
+};
+
+struct pht_reader {
+	struct pht_reader *next;
+	unsigned long epoch;	/* 0 outside read sections */
+};
+
 struct pht
 {
 	size_t (*rehash)(const void *, void *);
 	void *priv;
 	size_t elems;
 	struct list_head tables; /* of _pht_table */
+	unsigned flags, shrink;
+	const struct pht_alloc *alloc;
+	struct _pht_table *cache;
+	size_t cache_bytes, cache_max;
+	/* deferred reclamation under PHT_CONCURRENT_READ. */
+	unsigned long epoch;
+	struct pht_reader *readers;
+	struct _pht_table *limbo;
 };
 
 
@@ -27,9 +127,25 @@ struct pht
 
 extern void pht_init(struct pht *ht,
 	size_t (*rehash)(const void *elem, void *priv), void *priv);
+extern void pht_init_opts(struct pht *ht,
+	size_t (*rehash)(const void *elem, void *priv), void *priv,
+	const struct pht_opts *opts);
 
 extern size_t pht_count(const struct pht *ht);
+/* number of tables that lookups may have to visit, i.e. the primary and its
+ * not-yet-migrated secondaries.
+ */
+extern size_t pht_ntables(const struct pht *ht);
+/* number of those that a lookup of @hash visits, less the ones it rules out
+ * up front by migration or PHT_FILTER.
+ */
+extern size_t pht_ntables_for(const struct pht *ht, size_t hash);
 extern void pht_clear(struct pht *ht);
+/* remove all items from @ht, but keep the primary table's allocation for
+ * the next fill. under PHT_CONCURRENT_READ the same restriction applies as
+ * for pht_clear().
+ */
+extern void pht_reset(struct pht *ht);
 
 /* heavyweight fsck-like operation on @ht, useful for catching memory
  * corruption not found by valgrind. not compiled under NDEBUG. returns @ht
@@ -46,12 +162,50 @@ extern struct pht *pht_check(const struct pht *ht, const char *abortstr);
  */
 extern bool pht_add(struct pht *ht, size_t hash, const void *p);
 extern bool pht_del(struct pht *ht, size_t hash, const void *p);
+/* pht_add() with @val as @p's value word under PHT_MAP. pht_add() and
+ * pht_add_many() set it to 0.
+ */
+extern bool pht_add_val(struct pht *ht, size_t hash, const void *p,
+	uintptr_t val);
+
+/* batched pht_add(). adds @ptrs[i] under @hashes[i] for leading i < @n, and
+ * returns the number added; a return value less than @n means that
+ * pht_add() would've failed for @ptrs[retval]. room for the batch is made
+ * once, and migration proceeds at least as far as @n separate pht_add()
+ * calls would've taken it.
+ *
+ * NOTE: invalidates iterators the same way as pht_add().
+ */
+extern size_t pht_add_many(struct pht *ht, size_t n,
+	const size_t *hashes, const void *const *ptrs);
+
+/* explicit migration, e.g. for idle-time maintenance of a table that's
+ * stopped growing. pht_migrate() examines at most @budget slots of the
+ * oldest subtables, calling rehash at most once per slot, and returns true
+ * when migration is complete, i.e. lookups have only the primary table left
+ * to visit. a @budget of 0 only checks for that. pht_finish_migration()
+ * migrates everything that's left.
+ *
+ * NOTE: invalidates iterators the same way as pht_add().
+ */
+extern bool pht_migrate(struct pht *ht, size_t budget);
+extern void pht_finish_migration(struct pht *ht);
+
+/* make room for @n items in a single primary table, moving everything in
+ * @ht into it at once, so that loading up to @n items in total needs no
+ * further growth or migration. returns false on malloc failure, leaving @ht
+ * as it was.
+ *
+ * NOTE: invalidates iterators the same way as pht_add().
+ */
+extern bool pht_reserve(struct pht *ht, size_t n);
 
 /* @dst should be an uninitialized struct pht, a freshly-initialized one where
  * no items have been added, or one that's been pht_clear()ed and no items
  * added. on success, @dst is initialized to the same rehash/priv pair as @src
  * and contains exactly the same items as @src. on failure @dst will be
- * initialized the same way but left empty.
+ * initialized the same way but left empty. the copy takes time proportional
+ * to the size of @src's tables, and doesn't call rehash.
  */
 extern bool pht_copy(struct pht *dst, const struct pht *src);
 
@@ -70,6 +224,13 @@ extern void *pht_nextval(const struct pht *ht,
  */
 extern void pht_delval(struct pht *ht, struct pht_iter *it);
 
+/* under PHT_MAP, the value word of the item that @it was last positioned on
+ * by any of the iterator functions, which may be changed through the
+ * returned pointer until the next pht_add().
+ */
+extern uintptr_t *pht_iter_val(const struct pht *ht,
+	const struct pht_iter *it);
+
 static inline void *pht_get(const struct pht *ht, size_t h,
 	bool (*cmp)(const void *cand, void *ptr), const void *ptr)
 {
@@ -81,9 +242,169 @@ static inline void *pht_get(const struct pht *ht, size_t h,
 	return cand;
 }
 
+/* pht_get() under PHT_MAP. @cmp also gets each candidate's value word, so a
+ * key fingerprint kept there can reject most mismatches without touching
+ * @cand. the found item's value word is stored into *@val.
+ */
+static inline void *pht_get_val(const struct pht *ht, size_t h,
+	bool (*cmp)(const void *cand, uintptr_t val, void *ptr), const void *ptr,
+	uintptr_t *val)
+{
+	struct pht_iter it;
+	void *cand = pht_firstval(ht, &it, h);
+	while(cand != NULL) {
+		*val = *pht_iter_val(ht, &it);
+		if((*cmp)(cand, *val, (void *)ptr)) break;
+		cand = pht_nextval(ht, &it, h);
+	}
+	return cand;
+}
+
+/* batched pht_get(). resolves @n lookups in order, storing the result for
+ * @hashes[i] and @keys[i] into @out[i], while prefetching the home slots of
+ * the next few keys in every table that could hold them. returns the number
+ * of keys that were found.
+ */
+extern size_t pht_get_many(const struct pht *ht, size_t n,
+	const size_t *hashes, bool (*cmp)(const void *cand, void *ptr),
+	const void *const *keys, void **out);
+
 extern void *pht_first(const struct pht *ht, struct pht_iter *it);
 extern void *pht_next(const struct pht *ht, struct pht_iter *it);
 extern void *pht_prev(const struct pht *ht, struct pht_iter *it);
 
+/* type-safe wrappers in the style of CCAN's HTABLE_DEFINE_TYPE(). for items
+ * of @type whose key is @keyof(elem), hashed by @hashfn(key) and compared by
+ * @eqfn(elem, key), this defines struct @name and struct @name_iter, and
+ * static inline @name_init(), _init_opts(), _clear(), _count(), _copy(),
+ * _add(), _del(), _get(), _gethash(), _getfirst(), _getnext(), _delkey(),
+ * _delval(), _first(), and _next() over @type pointers and keys. as both
+ * callbacks are known at compile time, lookups inline them, and a table
+ * that has no secondaries makes no indirect calls at all. _gethash() is
+ * _get() for callers that have the hash at hand already.
+ */
+#define PHT_KTYPE(keyof, type) __typeof__(keyof((const type *)NULL))
+
+#define PHT_DEFINE_TYPE(type, keyof, hashfn, eqfn, name) \
+	struct name { struct pht raw; }; \
+	struct name##_iter { struct pht_iter i; }; \
+	static inline size_t name##_rehash(const void *elem, void *priv) { \
+		(void)priv; \
+		return hashfn(keyof((const type *)elem)); \
+	} \
+	static inline void name##_init(struct name *ht) { \
+		pht_init(&ht->raw, &name##_rehash, NULL); \
+	} \
+	static inline void name##_init_opts(struct name *ht, \
+		const struct pht_opts *opts) \
+	{ \
+		pht_init_opts(&ht->raw, &name##_rehash, NULL, opts); \
+	} \
+	static inline void name##_clear(struct name *ht) { \
+		pht_clear(&ht->raw); \
+	} \
+	static inline size_t name##_count(const struct name *ht) { \
+		return pht_count(&ht->raw); \
+	} \
+	static inline bool name##_copy(struct name *dst, \
+		const struct name *src) \
+	{ \
+		return pht_copy(&dst->raw, &src->raw); \
+	} \
+	static inline bool name##_add(struct name *ht, const type *elem) { \
+		return pht_add(&ht->raw, hashfn(keyof(elem)), elem); \
+	} \
+	static inline bool name##_del(struct name *ht, const type *elem) { \
+		return pht_del(&ht->raw, hashfn(keyof(elem)), elem); \
+	} \
+	static inline type *name##_match_(const struct name *ht, \
+		struct name##_iter *it, const PHT_KTYPE(keyof, type) k, \
+		type *cand) \
+	{ \
+		while(cand != NULL && !eqfn(cand, k)) { \
+			cand = pht_nextval(&ht->raw, &it->i, it->i.hash); \
+		} \
+		return cand; \
+	} \
+	static inline type *name##_getfirst(const struct name *ht, \
+		const PHT_KTYPE(keyof, type) k, struct name##_iter *it) \
+	{ \
+		return name##_match_(ht, it, k, \
+			pht_firstval(&ht->raw, &it->i, hashfn(k))); \
+	} \
+	static inline type *name##_getnext(const struct name *ht, \
+		const PHT_KTYPE(keyof, type) k, struct name##_iter *it) \
+	{ \
+		return name##_match_(ht, it, k, \
+			pht_nextval(&ht->raw, &it->i, it->i.hash)); \
+	} \
+	static inline type *name##_gethash(const struct name *ht, size_t h, \
+		const PHT_KTYPE(keyof, type) k) \
+	{ \
+		struct name##_iter it; \
+		return name##_match_(ht, &it, k, pht_firstval(&ht->raw, &it.i, h)); \
+	} \
+	static inline type *name##_get(const struct name *ht, \
+		const PHT_KTYPE(keyof, type) k) \
+	{ \
+		return name##_gethash(ht, hashfn(k), k); \
+	} \
+	static inline bool name##_delkey(struct name *ht, \
+		const PHT_KTYPE(keyof, type) k) \
+	{ \
+		struct name##_iter it; \
+		if(name##_getfirst(ht, k, &it) == NULL) return false; \
+		pht_delval(&ht->raw, &it.i); \
+		return true; \
+	} \
+	static inline void name##_delval(struct name *ht, \
+		struct name##_iter *it) \
+	{ \
+		pht_delval(&ht->raw, &it->i); \
+	} \
+	static inline type *name##_first(const struct name *ht, \
+		struct name##_iter *it) \
+	{ \
+		return pht_first(&ht->raw, &it->i); \
+	} \
+	static inline type *name##_next(const struct name *ht, \
+		struct name##_iter *it) \
+	{ \
+		return pht_next(&ht->raw, &it->i); \
+	}
+
+/* lock-free reading of a table initialized with PHT_CONCURRENT_READ. a
+ * single writer thread may call any function on @ht while any number of
+ * reader threads call pht_get(), pht_get_many(), and the pht_{first,next}val()
+ * and pht_{first,next}() iterators, but only between pht_read_enter() and
+ * pht_read_exit(). tables retired by the writer are freed once no reader
+ * that could've seen them remains in its read section.
+ *
+ * each reader thread has its own struct pht_reader, which is registered
+ * with pht_reader_add() from any thread before first use, and removed with
+ * pht_reader_del() by the writer while outside a read section. pht_clear()
+ * frees everything at once, and pht_reset() empties the primary in place, so
+ * they may only be called when no reader is inside a read section.
+ *
+ * concurrent readers see each item at least once between add and delete,
+ * and may see an item twice while the writer is moving it.
+ */
+extern void pht_reader_add(struct pht *ht, struct pht_reader *rd);
+extern void pht_reader_del(struct pht *ht, struct pht_reader *rd);
+
+static inline void pht_read_enter(const struct pht *ht, struct pht_reader *rd)
+{
+	/* a reader's 0 means "not reading", so readers record ht->epoch plus
+	 * one.
+	 */
+	__atomic_store_n(&rd->epoch,
+		__atomic_load_n(&ht->epoch, __ATOMIC_ACQUIRE) + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void pht_read_exit(struct pht_reader *rd) {
+	__atomic_store_n(&rd->epoch, 0, __ATOMIC_RELEASE);
+}
+
 
 #endif
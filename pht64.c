@@ -0,0 +1,297 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <ccan/list/list.h>
+#include <ccan/minmax/minmax.h>
+#include <ccan/bitops/bitops.h>
+
+#include "pht64.h"
+
+
+/* slot values, i.e. hashes, that aren't keys. */
+#define EMPTY 0
+#define TOMBSTONE 1
+
+
+struct _pht64_table
+{
+	struct list_node link;	/* in pht64.tables */
+	size_t elems, deleted;
+	/* next slot to migrate. migrated slots hold tombstones, so lookups may
+	 * ignore this while iteration starts from it.
+	 */
+	size_t nextmig;
+	int bits;
+	uint64_t table[];	/* hashes, see mix() */
+};
+
+
+/* murmur3's 64-bit finalizer. it's a bijection, so slots store the hash
+ * rather than the key and unmix() recovers the latter for iteration. that
+ * way comparison is on the hash alone, and migration knows an item's home
+ * slot without hashing anything, which is what pht's perfect bit is for.
+ */
+static inline uint64_t mix(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+
+static inline uint64_t unmix(uint64_t h)
+{
+	/* xorshifts by at least half the width are their own inverse, and the
+	 * constants are those of mix() inverted mod 2^64.
+	 */
+	h ^= h >> 33;
+	h *= 0x9cb4b2f8129337dbull;
+	h ^= h >> 33;
+	h *= 0x4f74430c22a54005ull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+static inline size_t t_bucket(const struct _pht64_table *t, uint64_t h) {
+	return h >> (64 - t->bits);
+}
+
+
+static size_t t_max_elems(const struct _pht64_table *t) {
+	return ((size_t)3 << t->bits) / 4;
+}
+
+
+/* same as pht's room_bits(). */
+static int room_bits(size_t room)
+{
+	size_t target = max_t(size_t, 4, (room * 4) / 3);
+	int bits = bitops_hs64(target);
+	if((size_t)1 << bits < target) bits++;
+	assert(((size_t)3 << bits) / 4 >= room);
+	return bits;
+}
+
+
+void pht64_init(struct pht64 *ht) {
+	*ht = (struct pht64)PHT64_INITIALIZER(*ht);
+}
+
+
+void pht64_clear(struct pht64 *ht)
+{
+	struct _pht64_table *t, *next;
+	list_for_each_safe(&ht->tables, t, next, link) {
+		list_del_from(&ht->tables, &t->link);
+		free(t);
+	}
+	pht64_init(ht);
+}
+
+
+size_t pht64_count(const struct pht64 *ht) {
+	return ht->elems + ht->special[EMPTY] + ht->special[TOMBSTONE];
+}
+
+
+size_t pht64_ntables(const struct pht64 *ht)
+{
+	size_t n = 0;
+	const struct _pht64_table *t;
+	list_for_each(&ht->tables, t, link) n++;
+	return n;
+}
+
+
+static void table_add(struct _pht64_table *t, uint64_t h)
+{
+	size_t mask = ((size_t)1 << t->bits) - 1, i = t_bucket(t, h);
+	while(t->table[i] > TOMBSTONE) i = (i + 1) & mask;
+	t->deleted -= t->table[i];
+	t->table[i] = h;
+	t->elems++;
+}
+
+
+/* returns the slot of @h in @t, or -1 if there's none. */
+static ssize_t table_find(const struct _pht64_table *t, uint64_t h)
+{
+	/* there's always an empty slot to stop at, since tables are replaced
+	 * well before they fill up and neither deletion nor migration empties
+	 * slots.
+	 */
+	size_t mask = ((size_t)1 << t->bits) - 1, i = t_bucket(t, h);
+	for(uint64_t cand; (cand = t->table[i]) != EMPTY; i = (i + 1) & mask) {
+		if(cand == h) return i;
+	}
+	return -1;
+}
+
+
+/* move items from the oldest secondaries into the primary, examining at most
+ * @budget slots.
+ */
+static void migrate(struct pht64 *ht, size_t budget)
+{
+	struct _pht64_table *t = list_top(&ht->tables, struct _pht64_table, link),
+		*mig;
+	while(budget > 0
+		&& (mig = list_tail(&ht->tables, struct _pht64_table, link)) != t)
+	{
+		size_t n = (size_t)1 << mig->bits;
+		while(budget > 0 && mig->elems > 0) {
+			assert(mig->nextmig < n);
+			uint64_t h = mig->table[mig->nextmig];
+			if(h > TOMBSTONE) {
+				/* (a tombstone rather than an empty slot, so that the rest of
+				 * its hash chain stays reachable.)
+				 */
+				mig->table[mig->nextmig] = TOMBSTONE;
+				mig->elems--;
+				table_add(t, h);
+			}
+			mig->nextmig++;
+			budget--;
+		}
+		if(mig->elems > 0) break;
+		list_del_from(&ht->tables, &mig->link);
+		free(mig);
+	}
+}
+
+
+/* replace the primary with a table that has room for twice the items, and
+ * pick a migration step that empties every secondary before it's full.
+ */
+static bool grow(struct pht64 *ht)
+{
+	struct _pht64_table *prev = list_top(&ht->tables,
+		struct _pht64_table, link);
+	int bits = room_bits(ht->elems * 2);
+	struct _pht64_table *t = calloc(1,
+		sizeof *t + sizeof(uint64_t) * ((size_t)1 << bits));
+	if(t == NULL) return false;
+	t->bits = bits;
+	list_add(&ht->tables, &t->link);
+
+	if(prev != NULL && prev->elems == 0) {
+		list_del_from(&ht->tables, &prev->link);
+		free(prev);
+	}
+
+	size_t left = 0;
+	struct _pht64_table *mig;
+	list_for_each(&ht->tables, mig, link) {
+		if(mig != t) left += ((size_t)1 << mig->bits) - mig->nextmig;
+	}
+	size_t adds = max_t(ssize_t, 1, (ssize_t)t_max_elems(t) - ht->elems);
+	ht->step = (left + adds - 1) / adds;
+	return true;
+}
+
+
+bool pht64_add(struct pht64 *ht, uint64_t key)
+{
+	uint64_t h = mix(key);
+	if(h <= TOMBSTONE) {
+		ht->special[h]++;
+		return true;
+	}
+
+	/* items not yet migrated count against the primary too, since they'll
+	 * end up there.
+	 */
+	struct _pht64_table *t = list_top(&ht->tables,
+		struct _pht64_table, link);
+	if(t == NULL || ht->elems + t->deleted >= t_max_elems(t)) {
+		if(!grow(ht)) return false;
+		t = list_top(&ht->tables, struct _pht64_table, link);
+	}
+
+	table_add(t, h);
+	ht->elems++;
+	migrate(ht, ht->step);
+	return true;
+}
+
+
+bool pht64_del(struct pht64 *ht, uint64_t key)
+{
+	uint64_t h = mix(key);
+	if(h <= TOMBSTONE) {
+		if(ht->special[h] == 0) return false;
+		ht->special[h]--;
+		return true;
+	}
+
+	struct _pht64_table *t;
+	list_for_each(&ht->tables, t, link) {
+		ssize_t i = table_find(t, h);
+		if(i >= 0) {
+			t->table[i] = TOMBSTONE;
+			t->elems--;
+			t->deleted++;
+			ht->elems--;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+bool pht64_get(const struct pht64 *ht, uint64_t key)
+{
+	uint64_t h = mix(key);
+	if(h <= TOMBSTONE) return ht->special[h] > 0;
+
+	const struct _pht64_table *t;
+	list_for_each(&ht->tables, t, link) {
+		if(table_find(t, h) >= 0) return true;
+	}
+	return false;
+}
+
+
+bool pht64_first(const struct pht64 *ht,
+	struct pht64_iter *it, uint64_t *key)
+{
+	it->t = NULL;
+	it->off = 0;
+	return pht64_next(ht, it, key);
+}
+
+
+bool pht64_next(const struct pht64 *ht,
+	struct pht64_iter *it, uint64_t *key)
+{
+	if(it->t == NULL) {
+		if(it->off == SIZE_MAX) return false;
+		if(it->off < ht->special[EMPTY] + ht->special[TOMBSTONE]) {
+			*key = unmix(it->off < ht->special[EMPTY] ? EMPTY : TOMBSTONE);
+			it->off++;
+			return true;
+		}
+		it->t = list_top(&ht->tables, struct _pht64_table, link);
+		if(it->t != NULL) it->off = it->t->nextmig;
+	}
+
+	while(it->t != NULL) {
+		while(it->off < (size_t)1 << it->t->bits) {
+			uint64_t h = it->t->table[it->off++];
+			if(h > TOMBSTONE) {
+				*key = unmix(h);
+				return true;
+			}
+		}
+		it->t = list_next(&ht->tables, it->t, link);
+		if(it->t != NULL) it->off = it->t->nextmig;
+	}
+	it->off = SIZE_MAX;
+	return false;
+}
@@ -0,0 +1,64 @@
+
+/* progressively rehashed multiset of 64-bit integers, stored inline in the
+ * slots rather than boxed behind pointers. same growth and migration scheme
+ * as pht, but keys are hashed by the container itself and compared directly,
+ * so there's neither a rehash nor a cmp callback.
+ */
+#ifndef _PHT64_H
+#define _PHT64_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ccan/list/list.h>
+
+
+struct _pht64_table;
+
+struct pht64
+{
+	size_t elems;
+	/* the two keys whose hashes are the empty and tombstone markers are
+	 * counted here instead.
+	 */
+	size_t special[2];
+	size_t step;	/* slots migrated per pht64_add() */
+	struct list_head tables; /* of _pht64_table */
+};
+
+
+#define PHT64_INITIALIZER(name) \
+	{ 0, { 0, 0 }, 0, LIST_HEAD_INIT((name).tables) }
+
+extern void pht64_init(struct pht64 *ht);
+extern void pht64_clear(struct pht64 *ht);
+
+extern size_t pht64_count(const struct pht64 *ht);
+/* same as pht_ntables(). */
+extern size_t pht64_ntables(const struct pht64 *ht);
+
+/* pht64_add() returns false on malloc failure. any key may be added, and
+ * more than once.
+ *
+ * NOTE: calling pht64_add() invalidates all iterators referencing @ht.
+ */
+extern bool pht64_add(struct pht64 *ht, uint64_t key);
+/* removes one instance of @key. returns false when there was none. */
+extern bool pht64_del(struct pht64 *ht, uint64_t key);
+extern bool pht64_get(const struct pht64 *ht, uint64_t key);
+
+struct pht64_iter {
+	struct _pht64_table *t;	/* NULL for the special keys */
+	size_t off;
+};
+
+/* iteration in no particular order. these return false once there are no
+ * more keys, and store the next one into *@key otherwise.
+ */
+extern bool pht64_first(const struct pht64 *ht,
+	struct pht64_iter *it, uint64_t *key);
+extern bool pht64_next(const struct pht64 *ht,
+	struct pht64_iter *it, uint64_t *key);
+
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "pht.h"
+#include "pht_sharded.h"
+
+
+struct _pht_shard
+{
+	pthread_mutex_t lock;
+	struct pht ht;
+} __attribute__((aligned(64)));	/* no false sharing between neighbours */
+
+
+/* pht's t_bucket() takes the top bits of the same mix, so the shard index
+ * stays independent of the in-shard bucket until tables grow to
+ * 1 << (64 - shard_bits) slots.
+ */
+static inline size_t shard_of(const struct pht_sharded *sh, size_t hash)
+{
+	hash ^= (hash >> 17) | (hash << (sizeof hash * CHAR_BIT - 17));
+	return hash & (((size_t)1 << sh->shard_bits) - 1);
+}
+
+
+bool pht_sharded_init(struct pht_sharded *sh, unsigned shard_bits,
+	size_t (*rehash)(const void *elem, void *priv), void *priv)
+{
+	assert(shard_bits < sizeof(size_t) * CHAR_BIT / 2);
+	size_t n = (size_t)1 << shard_bits;
+	sh->shard_bits = shard_bits;
+	sh->shards = aligned_alloc(__alignof__(struct _pht_shard),
+		sizeof *sh->shards * n);
+	if(sh->shards == NULL) return false;
+	for(size_t i=0; i < n; i++) {
+		pthread_mutex_init(&sh->shards[i].lock, NULL);
+		pht_init(&sh->shards[i].ht, rehash, priv);
+	}
+	return true;
+}
+
+
+void pht_sharded_clear(struct pht_sharded *sh)
+{
+	for(size_t i=0; i < (size_t)1 << sh->shard_bits; i++) {
+		pht_clear(&sh->shards[i].ht);
+		pthread_mutex_destroy(&sh->shards[i].lock);
+	}
+	free(sh->shards);
+	sh->shards = NULL;
+}
+
+
+size_t pht_sharded_count(const struct pht_sharded *sh)
+{
+	size_t count = 0;
+	for(size_t i=0; i < (size_t)1 << sh->shard_bits; i++) {
+		count += pht_count(&sh->shards[i].ht);
+	}
+	return count;
+}
+
+
+bool pht_sharded_add(struct pht_sharded *sh, size_t hash, const void *p)
+{
+	struct _pht_shard *s = &sh->shards[shard_of(sh, hash)];
+	pthread_mutex_lock(&s->lock);
+	bool ok = pht_add(&s->ht, hash, p);
+	pthread_mutex_unlock(&s->lock);
+	return ok;
+}
+
+
+bool pht_sharded_del(struct pht_sharded *sh, size_t hash, const void *p)
+{
+	struct _pht_shard *s = &sh->shards[shard_of(sh, hash)];
+	pthread_mutex_lock(&s->lock);
+	bool ok = pht_del(&s->ht, hash, p);
+	pthread_mutex_unlock(&s->lock);
+	return ok;
+}
+
+
+void *pht_sharded_get(const struct pht_sharded *sh, size_t h,
+	bool (*cmp)(const void *cand, void *ptr), const void *ptr)
+{
+	struct _pht_shard *s = &sh->shards[shard_of(sh, h)];
+	pthread_mutex_lock(&s->lock);
+	void *val = pht_get(&s->ht, h, cmp, ptr);
+	pthread_mutex_unlock(&s->lock);
+	return val;
+}
+
+
+void *pht_sharded_firstval(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it, size_t hash)
+{
+	it->shard = shard_of(sh, hash);
+	return pht_firstval(&sh->shards[it->shard].ht, &it->it, hash);
+}
+
+
+void *pht_sharded_nextval(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it, size_t hash)
+{
+	assert(it->shard == shard_of(sh, hash));
+	return pht_nextval(&sh->shards[it->shard].ht, &it->it, hash);
+}
+
+
+void pht_sharded_delval(struct pht_sharded *sh, struct pht_sharded_iter *it)
+{
+	pht_delval(&sh->shards[it->shard].ht, &it->it);
+}
+
+
+/* first item of the first non-empty shard from it->shard on. */
+static void *shard_first(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it)
+{
+	for(; it->shard < (size_t)1 << sh->shard_bits; it->shard++) {
+		void *val = pht_first(&sh->shards[it->shard].ht, &it->it);
+		if(val != NULL) return val;
+	}
+	return NULL;
+}
+
+
+void *pht_sharded_first(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it)
+{
+	it->shard = 0;
+	return shard_first(sh, it);
+}
+
+
+void *pht_sharded_next(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it)
+{
+	void *val = pht_next(&sh->shards[it->shard].ht, &it->it);
+	if(val != NULL) return val;
+	it->shard++;
+	return shard_first(sh, it);
+}
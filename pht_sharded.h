@@ -0,0 +1,68 @@
+
+/* a pht split into independently locked shards by hash, so that several
+ * threads may add and delete at once. each shard is a plain struct pht with
+ * its own progressive migration, so per-add costs stay as they were.
+ */
+#ifndef _PHT_SHARDED_H
+#define _PHT_SHARDED_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pht.h"
+
+
+struct _pht_shard;
+
+struct pht_sharded
+{
+	struct _pht_shard *shards;
+	unsigned shard_bits;
+};
+
+
+/* initializes @sh with 1 << @shard_bits shards, each like pht_init().
+ * returns false on malloc failure.
+ */
+extern bool pht_sharded_init(struct pht_sharded *sh, unsigned shard_bits,
+	size_t (*rehash)(const void *elem, void *priv), void *priv);
+extern void pht_sharded_clear(struct pht_sharded *sh);
+
+/* exact when no other thread is modifying @sh. */
+extern size_t pht_sharded_count(const struct pht_sharded *sh);
+
+/* same as pht_add(), pht_del(), and pht_get(), but take the lock of the
+ * shard that @hash falls into for the duration of the call. safe to call
+ * from any number of threads at once.
+ */
+extern bool pht_sharded_add(struct pht_sharded *sh, size_t hash,
+	const void *p);
+extern bool pht_sharded_del(struct pht_sharded *sh, size_t hash,
+	const void *p);
+extern void *pht_sharded_get(const struct pht_sharded *sh, size_t h,
+	bool (*cmp)(const void *cand, void *ptr), const void *ptr);
+
+/* iteration takes no locks, so it's only valid while no other thread
+ * modifies @sh, and invalidated by pht_sharded_add() the same way as
+ * pht_add() invalidates pht iterators.
+ */
+struct pht_sharded_iter {
+	struct pht_iter it;
+	size_t shard;
+};
+
+extern void *pht_sharded_firstval(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it, size_t hash);
+extern void *pht_sharded_nextval(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it, size_t hash);
+extern void pht_sharded_delval(struct pht_sharded *sh,
+	struct pht_sharded_iter *it);
+
+extern void *pht_sharded_first(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it);
+extern void *pht_sharded_next(const struct pht_sharded *sh,
+	struct pht_sharded_iter *it);
+
+
+#endif
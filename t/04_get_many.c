@@ -0,0 +1,108 @@
+
+/* pht_get_many() against pht_get(), both on a settled table and one that's
+ * in the middle of migration.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 3000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+/* look up every string in @strs and a nonexistent twin of each, in batches
+ * of @batch, and compare against pht_get().
+ */
+static bool batches_match(const struct pht *ht, char **strs, size_t batch)
+{
+	size_t n = N_STRS * 2;
+	const char *keys[n];
+	size_t hashes[n];
+	void *out[n];
+	char miss[N_STRS][20];
+	for(size_t i=0; i < N_STRS; i++) {
+		snprintf(miss[i], sizeof miss[i], "X%sX", strs[i]);
+		keys[i * 2] = strs[i];
+		keys[i * 2 + 1] = miss[i];
+	}
+	for(size_t i=0; i < n; i++) hashes[i] = rehash_str(keys[i], NULL);
+
+	bool ok = true;
+	for(size_t i=0; i < n; i += batch) {
+		size_t len = i + batch > n ? n - i : batch, found = pht_get_many(ht,
+			len, &hashes[i], &cmp_str, (const void **)&keys[i], &out[i]);
+		size_t expect = 0;
+		for(size_t j=i; j < i + len; j++) {
+			void *p = pht_get(ht, hashes[j], &cmp_str, keys[j]);
+			if(p != out[j]) {
+				diag("key=`%s' got=%p, pht_get()=%p", keys[j], out[j], p);
+				ok = false;
+			}
+			if(p != NULL) expect++;
+		}
+		if(found != expect) {
+			diag("found=%zu, expect=%zu at i=%zu", found, expect, i);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht = PHT_INITIALIZER(ht, &rehash_str, NULL);
+	ok1(batches_match(&ht, strs, 7));
+
+	/* stop while migration is still in progress. how soon that'll be
+	 * depends on where malloc put the strings, so go until it happens.
+	 */
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_str(strs[n], NULL), strs[n]);
+		n++;
+	} while(n < N_STRS && (n < N_STRS / 3 || pht_ntables(&ht) == 1));
+	diag("n=%d", n);
+	pht_check(&ht, NULL);
+	ok1(pht_ntables(&ht) > 1);
+	ok1(batches_match(&ht, strs, 1));
+	ok1(batches_match(&ht, strs, 100));
+
+	for(int i=n; i < N_STRS; i++) {
+		pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	ok1(batches_match(&ht, strs, 256));
+	ok1(batches_match(&ht, strs, N_STRS * 2));
+
+	pht_clear(&ht);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
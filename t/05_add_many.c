@@ -0,0 +1,151 @@
+
+/* pht_add_many() in batches of various sizes, onto empty and non-empty
+ * tables, and its behaviour wrt NULL.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 5000
+#define N_PTRS 2000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static size_t rehash_ptr(const void *p, void *priv) {
+	return hash(&p, 1, 0);
+}
+
+
+static bool cmp_ptr(const void *cand, void *key) {
+	return cand == key;
+}
+
+
+static bool all_found(const struct pht *ht, char **strs, size_t n)
+{
+	bool ok = true;
+	for(size_t i=0; i < n; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			diag("`%s' not found", strs[i]);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+int main(void)
+{
+	plan_tests(10);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	size_t *hashes = malloc(sizeof *hashes * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+		hashes[i] = rehash_str(strs[i], NULL);
+	}
+
+	/* one big batch into an empty table. */
+	struct pht ht = PHT_INITIALIZER(ht, &rehash_str, NULL);
+	ok1(pht_add_many(&ht, N_STRS, hashes, (const void **)strs) == N_STRS);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == N_STRS);
+	ok1(all_found(&ht, strs, N_STRS));
+	pht_clear(&ht);
+
+	/* growing batches after single adds, checking along the way. */
+	pht_init(&ht, &rehash_str, NULL);
+	bool adds_ok = true;
+	size_t n = 0;
+	for(size_t batch = 1; n < N_STRS; batch = batch * 3 / 2 + 1) {
+		if(!pht_add(&ht, hashes[n], strs[n])) adds_ok = false;
+		n++;
+		if(n + batch > N_STRS) batch = N_STRS - n;
+		if(pht_add_many(pht_check(&ht, NULL), batch,
+			&hashes[n], (const void **)&strs[n]) != batch)
+		{
+			diag("batch=%zu failed at n=%zu", batch, n);
+			adds_ok = false;
+		}
+		n += batch;
+	}
+	pht_check(&ht, NULL);
+	ok1(adds_ok);
+	ok1(pht_count(&ht) == N_STRS);
+	ok1(all_found(&ht, strs, N_STRS));
+	pht_clear(&ht);
+
+	/* small batches of made-up pointers that differ in one more high bit
+	 * every so often, so that changes of common bits link new primaries
+	 * while an older table is still being migrated. every item added so far
+	 * must stay reachable throughout.
+	 */
+	const void **ptrs = malloc(sizeof *ptrs * N_PTRS);
+	size_t *phashes = malloc(sizeof *phashes * N_PTRS);
+	bool ptrs_ok = true;
+	for(int seed=1; seed <= 30; seed++) {
+		srandom(seed);
+		for(int i=0; i < N_PTRS; i++) {
+			int bits = 8 + i * (sizeof(uintptr_t) * CHAR_BIT - 12) / N_PTRS;
+			uintptr_t r = ((uint64_t)random() << 33) ^ random();
+			r &= ((uintptr_t)1 << bits) - 1;
+			ptrs[i] = (void *)((r | (uintptr_t)1 << bits) << 3);
+			phashes[i] = rehash_ptr(ptrs[i], NULL);
+		}
+		pht_init(&ht, &rehash_ptr, NULL);
+		n = 0;
+		bool lost = false;
+		while(n < N_PTRS && !lost) {
+			size_t batch = random() % 3 == 0 ? 1 : random() % 16 + 1;
+			if(n + batch > N_PTRS) batch = N_PTRS - n;
+			pht_add_many(&ht, batch, &phashes[n], &ptrs[n]);
+			n += batch;
+			for(int i=0; i < n; i++) {
+				if(!pht_get(&ht, phashes[i], &cmp_ptr, (void *)ptrs[i])) {
+					diag("seed=%d: item %d lost at n=%zu", seed, i, n);
+					lost = true;
+					break;
+				}
+			}
+		}
+		if(lost) ptrs_ok = false;
+		pht_clear(&ht);
+	}
+	ok1(ptrs_ok);
+	free(ptrs);
+	free(phashes);
+
+	/* a NULL in the batch stops it there. */
+	pht_init(&ht, &rehash_str, NULL);
+	char *with_null[] = { strs[0], strs[1], NULL, strs[2] };
+	ok1(pht_add_many(&ht, 4, hashes, (const void **)with_null) == 2);
+	ok1(pht_count(&ht) == 2);
+	ok1(pht_add_many(&ht, 1, hashes, (const void **)&with_null[2]) == 0);
+	pht_clear(&ht);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+	free(hashes);
+
+	return exit_status();
+}
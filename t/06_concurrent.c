@@ -0,0 +1,149 @@
+
+/* lock-free readers under PHT_CONCURRENT_READ: while a writer keeps adding
+ * and removing items to force migration and table retirement, readers must
+ * always find the items that stay put and never find ones that weren't
+ * added, one at a time and by pht_get_many().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STABLE 2000
+#define N_CHURN 20000
+#define N_ROUNDS 8
+#define N_READERS 3
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static struct pht ht;
+static char **stable, **churn;
+static size_t *stable_hashes;
+static bool done = false;
+
+
+struct reader {
+	pthread_t thread;
+	struct pht_reader rd;
+	size_t passes, misses, false_hits;
+};
+
+
+static void *reader_fn(void *priv)
+{
+	struct reader *r = priv;
+	char miss[32];
+	void **out = malloc(sizeof *out * N_STABLE);
+	while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE) || r->passes == 0) {
+		pht_read_enter(&ht, &r->rd);
+		for(int i=0; i < N_STABLE; i++) {
+			const char *s = stable[i];
+			if(pht_get(&ht, rehash_str(s, NULL), &cmp_str, s) != s) {
+				r->misses++;
+			}
+			snprintf(miss, sizeof miss, "miss%d", i);
+			if(pht_get(&ht, rehash_str(miss, NULL), &cmp_str, miss) != NULL) {
+				r->false_hits++;
+			}
+		}
+		pht_get_many(&ht, N_STABLE, stable_hashes, &cmp_str,
+			(const void *const *)stable, out);
+		for(int i=0; i < N_STABLE; i++) {
+			if(out[i] != stable[i]) r->misses++;
+		}
+		pht_read_exit(&r->rd);
+		r->passes++;
+	}
+	free(out);
+	return NULL;
+}
+
+
+int main(void)
+{
+	plan_tests(4);
+
+	stable = malloc(sizeof *stable * N_STABLE);
+	churn = malloc(sizeof *churn * N_CHURN);
+	stable_hashes = malloc(sizeof *stable_hashes * N_STABLE);
+	for(int i=0; i < N_STABLE; i++) {
+		stable[i] = malloc(16);
+		snprintf(stable[i], 16, "stable%d", i);
+		stable_hashes[i] = rehash_str(stable[i], NULL);
+	}
+	for(int i=0; i < N_CHURN; i++) {
+		churn[i] = malloc(16);
+		snprintf(churn[i], 16, "churn%d", i);
+	}
+
+	pht_init_opts(&ht, &rehash_str, NULL,
+		&(struct pht_opts){ .flags = PHT_CONCURRENT_READ });
+	for(int i=0; i < N_STABLE; i++) {
+		pht_add(&ht, rehash_str(stable[i], NULL), stable[i]);
+	}
+
+	struct reader rs[N_READERS];
+	memset(rs, 0, sizeof rs);
+	for(int i=0; i < N_READERS; i++) {
+		pht_reader_add(&ht, &rs[i].rd);
+		pthread_create(&rs[i].thread, NULL, &reader_fn, &rs[i]);
+	}
+
+	/* fill up and drain the churn items a few times over. */
+	bool writes_ok = true;
+	for(int round=0; round < N_ROUNDS; round++) {
+		for(int i=0; i < N_CHURN; i++) {
+			if(!pht_add(&ht, rehash_str(churn[i], NULL), churn[i])) {
+				writes_ok = false;
+			}
+		}
+		for(int i=0; i < N_CHURN; i++) {
+			if(!pht_del(&ht, rehash_str(churn[i], NULL), churn[i])) {
+				writes_ok = false;
+			}
+		}
+	}
+	__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+
+	size_t passes = 0, misses = 0, false_hits = 0;
+	for(int i=0; i < N_READERS; i++) {
+		pthread_join(rs[i].thread, NULL);
+		pht_reader_del(&ht, &rs[i].rd);
+		passes += rs[i].passes;
+		misses += rs[i].misses;
+		false_hits += rs[i].false_hits;
+	}
+	diag("passes=%zu misses=%zu false_hits=%zu", passes, misses, false_hits);
+	ok1(writes_ok);
+	ok1(misses == 0);
+	ok1(false_hits == 0);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == N_STABLE);
+
+	pht_clear(&ht);
+	for(int i=0; i < N_STABLE; i++) free(stable[i]);
+	for(int i=0; i < N_CHURN; i++) free(churn[i]);
+	free(stable);
+	free(stable_hashes);
+	free(churn);
+
+	return exit_status();
+}
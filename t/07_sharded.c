@@ -0,0 +1,114 @@
+
+/* pht_sharded with several threads adding and deleting at once, then
+ * lookup and iteration over the result.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht_sharded.h"
+
+
+#define N_STRS 40000
+#define N_THREADS 4
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static struct pht_sharded sh;
+static char **strs;
+
+
+/* each thread adds its own slice, then deletes every third item of it. */
+static void *writer_fn(void *priv)
+{
+	intptr_t i = (intptr_t)priv - 1;
+	size_t first = N_STRS * i / N_THREADS, last = N_STRS * (i + 1) / N_THREADS;
+	bool ok = true;
+	for(size_t j=first; j < last; j++) {
+		if(!pht_sharded_add(&sh, rehash_str(strs[j], NULL), strs[j])) {
+			ok = false;
+		}
+	}
+	for(size_t j=first; j < last; j += 3) {
+		if(!pht_sharded_del(&sh, rehash_str(strs[j], NULL), strs[j])) {
+			ok = false;
+		}
+	}
+	return ok ? priv : NULL;
+}
+
+
+int main(void)
+{
+	plan_tests(5);
+
+	strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	ok1(pht_sharded_init(&sh, 4, &rehash_str, NULL));
+	pthread_t threads[N_THREADS];
+	for(intptr_t i=0; i < N_THREADS; i++) {
+		/* (+1 so that NULL can mean failure.) */
+		pthread_create(&threads[i], NULL, &writer_fn, (void *)(i + 1));
+	}
+	bool writes_ok = true;
+	for(int i=0; i < N_THREADS; i++) {
+		void *ret;
+		pthread_join(threads[i], &ret);
+		if(ret == NULL) writes_ok = false;
+	}
+	ok1(writes_ok);
+
+	size_t expect = 0;
+	bool found_ok = true;
+	for(int i=0; i < N_THREADS; i++) {
+		size_t first = N_STRS * i / N_THREADS,
+			last = N_STRS * (i + 1) / N_THREADS;
+		for(size_t j=first; j < last; j++) {
+			bool present = (j - first) % 3 != 0;
+			void *p = pht_sharded_get(&sh, rehash_str(strs[j], NULL),
+				&cmp_str, strs[j]);
+			if((p != NULL) != present) {
+				diag("`%s' present=%d, found=%d", strs[j], present, p != NULL);
+				found_ok = false;
+			}
+			expect += present;
+		}
+	}
+	ok1(found_ok);
+	ok1(pht_sharded_count(&sh) == expect);
+
+	size_t seen = 0;
+	struct pht_sharded_iter it;
+	for(void *p = pht_sharded_first(&sh, &it); p != NULL;
+		p = pht_sharded_next(&sh, &it))
+	{
+		seen++;
+	}
+	ok1(seen == expect);
+
+	pht_sharded_clear(&sh);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
@@ -0,0 +1,60 @@
+
+/* pointers that differ from the first one added only in bits that were
+ * already left out of the common set, which would leave nothing to tell them
+ * apart from an empty slot or a tombstone. the pointers are never
+ * dereferenced.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/tap/tap.h>
+
+#include "pht.h"
+
+
+/* everything in one hash chain, so only the first item sits in its home
+ * slot.
+ */
+static size_t same_hash(const void *ptr, void *priv) {
+	return 0;
+}
+
+
+static bool cmp_ptr(const void *cand, void *ptr) {
+	return cand == ptr;
+}
+
+
+int main(void)
+{
+	static const uintptr_t ptrs[] = { 0x1010, 0x1000, 0x1001, 0x1011 };
+
+	plan_tests(4);
+
+	struct pht ht = PHT_INITIALIZER(ht, &same_hash, NULL);
+	bool ok = true;
+	for(int i=0; i < ARRAY_SIZE(ptrs); i++) {
+		if(!pht_add(&ht, 0, (void *)ptrs[i])) ok = false;
+	}
+	ok1(ok);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == ARRAY_SIZE(ptrs));
+
+	int found = 0;
+	for(int i=0; i < ARRAY_SIZE(ptrs); i++) {
+		if(pht_get(&ht, 0, &cmp_ptr, (void *)ptrs[i]) != NULL) found++;
+	}
+	ok1(found == ARRAY_SIZE(ptrs));
+
+	int seen = 0;
+	struct pht_iter it;
+	for(void *p = pht_first(&ht, &it); p != NULL; p = pht_next(&ht, &it)) {
+		seen++;
+	}
+	ok1(seen == ARRAY_SIZE(ptrs));
+
+	pht_clear(&ht);
+
+	return exit_status();
+}
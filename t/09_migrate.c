@@ -0,0 +1,96 @@
+
+/* pht_migrate() in small steps and pht_finish_migration() on a table that's
+ * stopped growing in the middle of migration.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 3000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static bool all_found(const struct pht *ht, char **strs, size_t n)
+{
+	bool ok = true;
+	for(size_t i=0; i < n; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			diag("`%s' not found", strs[i]);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+int main(void)
+{
+	plan_tests(8);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht = PHT_INITIALIZER(ht, &rehash_str, NULL);
+	ok1(pht_migrate(&ht, 0));
+
+	/* stop while migration is still in progress. how soon that'll be
+	 * depends on where malloc put the strings, so go until it happens.
+	 */
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_str(strs[n], NULL), strs[n]);
+		n++;
+	} while(n < N_STRS && (n < N_STRS / 3 || pht_ntables(&ht) == 1));
+	diag("n=%d", n);
+	ok1(!pht_migrate(&ht, 0));
+
+	/* a few slots at a time. */
+	int steps = 0;
+	bool steps_ok = true;
+	do {
+		steps++;
+		pht_check(&ht, NULL);
+		if(!all_found(&ht, strs, n)) steps_ok = false;
+	} while(!pht_migrate(&ht, 16));
+	diag("steps=%d", steps);
+	ok1(steps > 1);
+	ok1(steps_ok);
+	ok1(pht_count(&ht) == n);
+
+	/* and all at once. */
+	for(int i=n; i < N_STRS; i++) {
+		pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_finish_migration(&ht);
+	ok1(pht_migrate(&ht, 0));
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == N_STRS);
+	ok1(all_found(&ht, strs, N_STRS));
+
+	pht_clear(&ht);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
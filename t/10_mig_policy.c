@@ -0,0 +1,100 @@
+
+/* PHT_MIG_ON_DEL and PHT_MIG_ON_GET: deletes and lookups on a table that's
+ * stopped growing in the middle of migration should finish it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 2000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+/* add items until @ht has just grown, so that there's migration left to do.
+ * returns how many were added.
+ */
+static int fill(struct pht *ht, char **strs, unsigned flags)
+{
+	pht_init_opts(ht, &rehash_str, NULL, &(struct pht_opts){ .flags = flags });
+	int n = 0;
+	do {
+		pht_add(ht, rehash_str(strs[n], NULL), strs[n]);
+		n++;
+	} while(n < N_STRS && (n < N_STRS / 2 || pht_ntables(ht) == 1));
+	return n;
+}
+
+
+int main(void)
+{
+	plan_tests(7);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	/* without either, nothing happens. */
+	struct pht ht;
+	int n = fill(&ht, strs, 0);
+	size_t before = pht_ntables(&ht);
+	diag("before=%zu", before);
+	ok1(before > 1);
+	for(int i=0; i < n; i++) {
+		pht_get(&ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]);
+	}
+	ok1(pht_ntables(&ht) == before);
+	pht_clear(&ht);
+
+	/* deletes. each one migrates at least one item, so deleting three in
+	 * four is plenty even when a change of common bits left a third table.
+	 */
+	n = fill(&ht, strs, PHT_MIG_ON_DEL);
+	bool del_ok = true;
+	for(int i=0; i < n; i++) {
+		if(i % 4 == 0) continue;
+		if(!pht_del(&ht, rehash_str(strs[i], NULL), strs[i])) del_ok = false;
+	}
+	ok1(del_ok);
+	pht_check(&ht, NULL);
+	ok1(pht_ntables(&ht) == 1);
+	pht_clear(&ht);
+
+	/* lookups. */
+	n = fill(&ht, strs, PHT_MIG_ON_GET);
+	bool get_ok = true;
+	for(int i=0; i < n; i++) {
+		if(pht_get(&ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			get_ok = false;
+		}
+	}
+	ok1(get_ok);
+	pht_check(&ht, NULL);
+	ok1(pht_ntables(&ht) == 1);
+	ok1(pht_count(&ht) == n);
+	pht_clear(&ht);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
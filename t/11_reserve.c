@@ -0,0 +1,126 @@
+
+/* pht_reserve() on empty and non-empty tables: loading up to the reserved
+ * count afterward shouldn't grow the table, or leave anything to migrate.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 5000
+#define N_BIG (1 << 20)
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static size_t rehash_ptr(const void *p, void *priv) {
+	return hash(&p, 1, 0);
+}
+
+
+/* add strs[first..last), checking that there's only ever the one table. */
+static bool add_range(struct pht *ht, char **strs, int first, int last)
+{
+	bool ok = true;
+	for(int i=first; i < last; i++) {
+		if(!pht_add(ht, rehash_str(strs[i], NULL), strs[i])) ok = false;
+		if(pht_ntables(ht) != 1) {
+			diag("ntables=%zu after i=%d", pht_ntables(ht), i);
+			ok = false;
+			break;
+		}
+	}
+	return ok;
+}
+
+
+static bool all_found(const struct pht *ht, char **strs, int n)
+{
+	for(int i=0; i < n; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			diag("`%s' not found", strs[i]);
+			return false;
+		}
+	}
+	return pht_count(ht) == n;
+}
+
+
+int main(void)
+{
+	plan_tests(9);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	/* from empty. */
+	struct pht ht = PHT_INITIALIZER(ht, &rehash_str, NULL);
+	ok1(pht_reserve(&ht, N_STRS));
+	ok1(add_range(&ht, strs, 0, N_STRS));
+	pht_check(&ht, NULL);
+	ok1(all_found(&ht, strs, N_STRS));
+	pht_clear(&ht);
+
+	/* with some items already in, and migration going on. these are picked
+	 * from all over so that the rest won't change the common bits.
+	 */
+	pht_init(&ht, &rehash_str, NULL);
+	char **order = malloc(sizeof *order * N_STRS);
+	int n = 0;
+	for(int i=0; i < N_STRS; i += 7) order[n++] = strs[i];
+	for(int i=0, k=n; i < N_STRS; i++) {
+		if(i % 7 != 0) order[k++] = strs[i];
+	}
+	for(int i=0; i < n; i++) {
+		pht_add(&ht, rehash_str(order[i], NULL), order[i]);
+	}
+	ok1(pht_reserve(&ht, N_STRS));
+	ok1(pht_ntables(&ht) == 1 && all_found(&ht, order, n));
+	ok1(add_range(&ht, order, n, N_STRS));
+	pht_check(&ht, NULL);
+	ok1(all_found(&ht, order, N_STRS));
+	free(order);
+	pht_clear(&ht);
+
+	/* a big reservation on an empty table, loaded with pointers unlike the
+	 * table's own address. the pointers are never dereferenced.
+	 */
+	pht_init(&ht, &rehash_ptr, NULL);
+	ok1(pht_reserve(&ht, N_BIG));
+	bool big_ok = true;
+	for(uintptr_t i=0; i < N_BIG; i++) {
+		void *p = (void *)((uintptr_t)0xffff800000001000ull + i * 8);
+		if(!pht_add(&ht, rehash_ptr(p, NULL), p)) big_ok = false;
+		if(pht_ntables(&ht) != 1) {
+			diag("ntables=%zu after i=%zu", pht_ntables(&ht), (size_t)i);
+			big_ok = false;
+			break;
+		}
+	}
+	ok1(big_ok && pht_count(&ht) == N_BIG);
+	pht_clear(&ht);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
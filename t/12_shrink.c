@@ -0,0 +1,122 @@
+
+/* pht_opts.shrink: deleting most items should migrate what's left into a
+ * smaller table, and deleting nearly all should leave a tiny one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 20000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+/* about the primary table's size, from how far iteration goes. */
+static size_t span(const struct pht *ht)
+{
+	size_t max_off = 0;
+	struct pht_iter it;
+	for(void *p = pht_first(ht, &it); p != NULL; p = pht_next(ht, &it)) {
+		if(it.off > max_off) max_off = it.off;
+	}
+	return max_off;
+}
+
+
+int main(void)
+{
+	plan_tests(7);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){ .shrink = 16 });
+	for(int i=0; i < N_STRS; i++) {
+		pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_finish_migration(&ht);
+	size_t big = span(&ht);
+	diag("big=%zu", big);
+
+	/* leave one in 64. */
+	bool del_ok = true;
+	for(int i=0; i < N_STRS; i++) {
+		if(i % 64 == 0) continue;
+		if(!pht_del(&ht, rehash_str(strs[i], NULL), strs[i])) del_ok = false;
+	}
+	ok1(del_ok);
+	pht_check(&ht, NULL);
+	diag("ntables=%zu", pht_ntables(&ht));
+	ok1(pht_migrate(&ht, N_STRS));
+	size_t small = span(&ht);
+	diag("small=%zu", small);
+	ok1(small < big / 4);
+
+	bool found_ok = true;
+	for(int i=0; i < N_STRS; i += 64) {
+		if(pht_get(&ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			found_ok = false;
+		}
+	}
+	ok1(found_ok);
+	ok1(pht_count(&ht) == (N_STRS + 63) / 64);
+
+	/* and then most of the rest, leaving one item in a tiny table. */
+	for(int i=64; i < N_STRS; i += 64) {
+		pht_del(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_finish_migration(&ht);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == 1 && span(&ht) < 16);
+
+	pht_clear(&ht);
+
+	/* the same by way of pht_delval(), migrating separately. */
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){ .shrink = 16 });
+	for(int i=0; i < N_STRS; i++) {
+		pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_finish_migration(&ht);
+	for(int i=0; i < N_STRS; i++) {
+		if(i % 64 == 0) continue;
+		struct pht_iter it;
+		size_t hash = rehash_str(strs[i], NULL);
+		for(void *cand = pht_firstval(&ht, &it, hash); cand != NULL;
+			cand = pht_nextval(&ht, &it, hash))
+		{
+			if(cand == strs[i]) pht_delval(&ht, &it);
+		}
+	}
+	pht_check(&ht, NULL);
+	pht_finish_migration(&ht);
+	small = span(&ht);
+	diag("small=%zu", small);
+	ok1(small < big / 2 && pht_count(&ht) == (N_STRS + 63) / 64);
+	pht_clear(&ht);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
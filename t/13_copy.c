@@ -0,0 +1,91 @@
+
+/* pht_copy() in the middle of migration: the copy should have everything
+ * without a single rehash, and keep working as a table of its own.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 3000
+
+
+static size_t n_rehash = 0;
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	n_rehash++;
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static bool all_found(const struct pht *ht, char **strs, int n)
+{
+	for(int i=0; i < n; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			diag("`%s' not found", strs[i]);
+			return false;
+		}
+	}
+	return pht_count(ht) == n;
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht = PHT_INITIALIZER(ht, &rehash_str, NULL);
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_str(strs[n], NULL), strs[n]);
+		n++;
+	} while(n < N_STRS && (n < N_STRS / 3 || pht_ntables(&ht) == 1));
+	diag("n=%d, ntables=%zu", n, pht_ntables(&ht));
+
+	struct pht copy;
+	n_rehash = 0;
+	ok1(pht_copy(&copy, &ht));
+	ok1(n_rehash == 0);
+	pht_check(&copy, NULL);
+	ok1(pht_ntables(&copy) == pht_ntables(&ht));
+	ok1(all_found(&copy, strs, n));
+
+	/* the two are separate from here on. */
+	for(int i=n; i < N_STRS; i++) {
+		pht_add(&copy, rehash_str(strs[i], NULL), strs[i]);
+	}
+	for(int i=0; i < n; i += 2) {
+		pht_del(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_check(&ht, NULL);
+	pht_check(&copy, NULL);
+	ok1(all_found(&copy, strs, N_STRS));
+	ok1(pht_count(&ht) == n / 2);
+
+	pht_clear(&ht);
+	pht_clear(&copy);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
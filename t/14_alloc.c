@@ -0,0 +1,145 @@
+
+/* pht_opts.alloc: every table should come from, and go back to, the given
+ * allocator with matching sizes, also by way of limbo under
+ * PHT_CONCURRENT_READ and by pht_copy().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 5000
+
+
+struct counts {
+	size_t allocs, frees, live_bytes;
+	bool sizes_ok;
+};
+
+
+/* the size goes in a cacheline of its own in front, so that free() can
+ * check it and the table stays aligned.
+ */
+static void *count_alloc(size_t size, void *priv)
+{
+	struct counts *c = priv;
+	size_t *p;
+	if(posix_memalign((void **)&p, 64, 64 + size) != 0) return NULL;
+	memset(p, 0, 64 + size);
+	p[0] = size;
+	c->allocs++;
+	c->live_bytes += size;
+	return (char *)p + 64;
+}
+
+
+static void count_free(void *ptr, size_t size, void *priv)
+{
+	struct counts *c = priv;
+	size_t *p = (size_t *)((char *)ptr - 64);
+	if(p[0] != size) c->sizes_ok = false;
+	c->frees++;
+	c->live_bytes -= p[0];
+	free(p);
+}
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+/* after churn(), the odd ones are left. */
+static bool odds_found(const struct pht *ht, char **strs)
+{
+	for(int i=1; i < N_STRS; i += 2) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			return false;
+		}
+	}
+	return pht_count(ht) == N_STRS / 2;
+}
+
+
+static void churn(struct pht *ht, char **strs)
+{
+	for(int i=0; i < N_STRS; i++) {
+		pht_add(ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	for(int i=0; i < N_STRS; i += 2) {
+		pht_del(ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+}
+
+
+int main(void)
+{
+	plan_tests(9);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct counts c = { .sizes_ok = true };
+	struct pht_alloc alloc = {
+		.alloc_zeroed = &count_alloc, .free = &count_free, .priv = &c,
+	};
+
+	/* plain, and a copy of it. */
+	struct pht ht, copy;
+	pht_init_opts(&ht, &rehash_str, NULL,
+		&(struct pht_opts){ .alloc = &alloc, .shrink = 16 });
+	churn(&ht, strs);
+	pht_check(&ht, NULL);
+	ok1(c.allocs > 1 && c.frees > 0);
+	size_t before = c.allocs;
+	ok1(pht_copy(&copy, &ht));
+	ok1(c.allocs == before + pht_ntables(&ht));
+	ok1(odds_found(&copy, strs));
+	pht_clear(&ht);
+	pht_clear(&copy);
+	ok1(c.allocs == c.frees && c.live_bytes == 0);
+
+	/* a reservation set up by its first item, which mustn't change the size
+	 * that it's freed at.
+	 */
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){ .alloc = &alloc });
+	pht_reserve(&ht, N_STRS);
+	pht_add(&ht, rehash_str(strs[0], NULL), strs[0]);
+	pht_clear(&ht);
+	ok1(c.sizes_ok && c.allocs == c.frees && c.live_bytes == 0);
+
+	/* with tables in limbo. */
+	struct pht_reader rd;
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){
+		.alloc = &alloc, .flags = PHT_CONCURRENT_READ });
+	pht_reader_add(&ht, &rd);
+	pht_read_enter(&ht, &rd);
+	churn(&ht, strs);
+	ok1(c.allocs > c.frees);
+	pht_read_exit(&rd);
+	pht_reader_del(&ht, &rd);
+	pht_clear(&ht);
+	ok1(c.allocs == c.frees && c.live_bytes == 0);
+	ok1(c.sizes_ok);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
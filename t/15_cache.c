@@ -0,0 +1,217 @@
+
+/* pht_opts.cache_max and pht_reset(): refilling to the same size should
+ * need no new allocations once the tables involved have been around once.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 5000
+#define N_BIG 300000
+
+
+static size_t n_allocs = 0, n_frees = 0;
+static bool sizes_ok = true;
+
+
+/* the size goes in a cacheline of its own in front, so that free() can
+ * check it and the table stays aligned.
+ */
+static void *count_alloc(size_t size, void *priv)
+{
+	size_t *p;
+	if(posix_memalign((void **)&p, 64, 64 + size) != 0) return NULL;
+	memset(p, 0, 64 + size);
+	p[0] = size;
+	n_allocs++;
+	return (char *)p + 64;
+}
+
+
+static void count_free(void *ptr, size_t size, void *priv)
+{
+	size_t *p = (size_t *)((char *)ptr - 64);
+	if(p[0] != size) sizes_ok = false;
+	n_frees++;
+	free(p);
+}
+
+
+/* bytes of address space mapped, or -1 where /proc isn't available. */
+static ssize_t mapped_bytes(void)
+{
+	FILE *f = fopen("/proc/self/maps", "r");
+	if(f == NULL) return -1;
+	ssize_t total = 0;
+	unsigned long lo, hi;
+	char line[512];
+	while(fgets(line, sizeof line, f) != NULL) {
+		if(sscanf(line, "%lx-%lx", &lo, &hi) == 2) total += hi - lo;
+	}
+	fclose(f);
+	return total;
+}
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static bool fill(struct pht *ht, char **strs)
+{
+	for(int i=0; i < N_STRS; i++) {
+		pht_add(ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	for(int i=0; i < N_STRS; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i]) == NULL) {
+			return false;
+		}
+	}
+	return pht_count(ht) == N_STRS;
+}
+
+
+static const struct pht_alloc alloc = {
+	.alloc_zeroed = &count_alloc, .free = &count_free,
+};
+
+
+/* fill and empty a table over and over, and return the number of
+ * allocations made past the first two rounds.
+ */
+static size_t churn(char **strs, size_t cache_max)
+{
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){
+		.alloc = &alloc, .cache_max = cache_max });
+	size_t before = 0;
+	for(int round=0; round < 10; round++) {
+		if(round == 2) before = n_allocs;
+		for(int i=0; i < N_STRS; i++) {
+			pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+		}
+		for(int i=0; i < N_STRS; i++) {
+			pht_del(&ht, rehash_str(strs[i], NULL), strs[i]);
+		}
+	}
+	pht_check(&ht, NULL);
+	size_t n = n_allocs - before;
+	pht_clear(&ht);
+	return n;
+}
+
+
+int main(void)
+{
+	plan_tests(13);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_str, NULL, &(struct pht_opts){
+		.alloc = &alloc, .cache_max = 1 << 20 });
+
+	/* the first fill allocates every size on the way up, keeping the ones
+	 * it's done with.
+	 */
+	ok1(fill(&ht, strs));
+	pht_check(&ht, NULL);
+	size_t first = n_allocs;
+	diag("first=%zu frees=%zu", first, n_frees);
+	ok1(n_frees == 0);
+
+	/* reset keeps the primary, so a refill doesn't allocate at all. */
+	pht_finish_migration(&ht);
+	pht_reset(&ht);
+	ok1(pht_count(&ht) == 0 && pht_ntables(&ht) == 1);
+	ok1(pht_get(&ht, rehash_str(strs[0], NULL), &cmp_str, strs[0]) == NULL);
+	ok1(fill(&ht, strs));
+	pht_check(&ht, NULL);
+	ok1(n_allocs == first);
+
+	/* and once more, starting with an item whose high bits differ from
+	 * the table's earlier contents, which come from malloc(). that sets up
+	 * the common bits anew in the same table, which must stay the size that
+	 * it was allocated at, or in one just as large when the item doesn't fit
+	 * the compact slots that the earlier contents did.
+	 */
+	char *far = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	strcpy(far, "far");
+	pht_reset(&ht);
+	pht_add(&ht, rehash_str(far, NULL), far);
+	ok1(pht_ntables(&ht) == 1);
+	fill(&ht, strs);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == N_STRS + 1
+		&& pht_get(&ht, rehash_str(far, NULL), &cmp_str, far) == far);
+
+	pht_clear(&ht);
+	ok1(n_allocs == n_frees && sizes_ok);
+
+	/* emptying a table frees the last of it, so filling it up again
+	 * allocates every size on the way up without the cache, and nothing
+	 * with.
+	 */
+	size_t without = churn(strs, 0), with = churn(strs, 1 << 20);
+	diag("without=%zu with=%zu", without, with);
+	ok1(without > 0);
+	ok1(with == 0);
+
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	/* the same on a table big enough to come from mmap(), which must be
+	 * unmapped at the size it was mapped at.
+	 */
+	char **big = calloc(N_BIG, sizeof *big);
+	for(int i=0; i < N_BIG; i++) {
+		big[i] = malloc(16);
+		snprintf(big[i], 16, "big%d", i);
+	}
+	pht_init(&ht, &rehash_str, NULL);
+	for(int i=0; i < N_BIG; i++) {
+		pht_add(&ht, rehash_str(big[i], NULL), big[i]);
+	}
+	pht_finish_migration(&ht);
+	pht_reset(&ht);
+	pht_add(&ht, rehash_str(far, NULL), far);
+	pht_check(&ht, NULL);
+	ok1(pht_count(&ht) == 1 && pht_ntables(&ht) == 1
+		&& pht_get(&ht, rehash_str(far, NULL), &cmp_str, far) == far);
+	ssize_t before = mapped_bytes();
+	pht_clear(&ht);
+	ssize_t after = mapped_bytes();
+	munmap(far, 4096);
+	if(before < 0 || after < 0) skip(1, "no /proc/self/maps");
+	else {
+		diag("unmapped=%zd", before - after);
+		ok1(before - after >= 1 << 20);
+	}
+
+	for(int i=0; i < N_BIG; i++) free(big[i]);
+	free(big);
+
+	return exit_status();
+}
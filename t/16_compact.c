@@ -0,0 +1,90 @@
+
+/* tables switching from 32-bit slots to full-width ones when the pointers'
+ * spread outgrows the former. the pointers are never dereferenced.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_PTRS 3000
+
+
+static size_t hash_ptr(const void *ptr, void *priv) {
+	return hash(&ptr, 1, 0);
+}
+
+
+static bool cmp_ptr(const void *cand, void *ptr) {
+	return cand == ptr;
+}
+
+
+static void *near_ptr(int i) {
+	return (void *)(uintptr_t)(0x10000 + i * 16);
+}
+
+
+static void *far_ptr(int i) {
+	return (void *)((uintptr_t)0x7f1234560000 + i * 16);
+}
+
+
+static int n_found(const struct pht *ht, void *(*ptr)(int), int n)
+{
+	int found = 0;
+	for(int i=0; i < n; i++) {
+		void *p = (*ptr)(i);
+		if(pht_get(ht, hash_ptr(p, NULL), &cmp_ptr, p) == p) found++;
+	}
+	return found;
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	struct pht ht = PHT_INITIALIZER(ht, &hash_ptr, NULL);
+	for(int i=0; i < N_PTRS; i++) {
+		pht_add(&ht, hash_ptr(near_ptr(i), NULL), near_ptr(i));
+	}
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, &near_ptr, N_PTRS) == N_PTRS);
+
+	/* the first far one doesn't fit in 32 bits, so it brings about a new
+	 * full-width table, and the next few go in while the compact one is still
+	 * being migrated from.
+	 */
+	pht_add(&ht, hash_ptr(far_ptr(0), NULL), far_ptr(0));
+	ok1(pht_ntables(&ht) > 1);
+	for(int i=1; i < N_PTRS / 2; i++) {
+		pht_add(&ht, hash_ptr(far_ptr(i), NULL), far_ptr(i));
+	}
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, &near_ptr, N_PTRS) == N_PTRS);
+	ok1(n_found(&ht, &far_ptr, N_PTRS / 2) == N_PTRS / 2);
+
+	for(int i=N_PTRS / 2; i < N_PTRS; i++) {
+		pht_add(&ht, hash_ptr(far_ptr(i), NULL), far_ptr(i));
+	}
+	pht_finish_migration(&ht);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, &near_ptr, N_PTRS) + n_found(&ht, &far_ptr, N_PTRS)
+		== N_PTRS * 2);
+
+	int seen = 0;
+	struct pht_iter it;
+	for(void *p = pht_first(&ht, &it); p != NULL; p = pht_next(&ht, &it)) {
+		seen++;
+	}
+	ok1(seen == N_PTRS * 2);
+
+	pht_clear(&ht);
+
+	return exit_status();
+}
@@ -0,0 +1,89 @@
+
+/* pht64: integer keys through growth, migration, and deletion, including
+ * the two keys that hash to the empty and tombstone markers.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+
+#include "pht64.h"
+
+
+#define N_KEYS 20000
+
+
+/* the keys whose hashes are 0 and 1 in pht64.c. */
+#define SPECIAL_0 0
+#define SPECIAL_1 0x50bf096683646df0ull
+
+
+static uint64_t key_of(int i) {
+	return (uint64_t)i * 0x9e3779b97f4a7c15ull;
+}
+
+
+static int n_found(const struct pht64 *ht, int from, int to)
+{
+	int found = 0;
+	for(int i=from; i < to; i++) {
+		if(pht64_get(ht, key_of(i))) found++;
+	}
+	return found;
+}
+
+
+int main(void)
+{
+	plan_tests(11);
+
+	struct pht64 ht = PHT64_INITIALIZER(ht);
+	ok1(!pht64_get(&ht, 1234));
+
+	/* stop growing in the middle of migration. */
+	int n = 0;
+	do {
+		pht64_add(&ht, key_of(n++));
+	} while(n < N_KEYS / 2 || pht64_ntables(&ht) == 1);
+	ok1(n_found(&ht, 0, n) == n);
+
+	for(int i=n; i < N_KEYS; i++) pht64_add(&ht, key_of(i));
+	ok1(pht64_count(&ht) == N_KEYS);
+	ok1(n_found(&ht, 0, N_KEYS) == N_KEYS);
+	ok1(!pht64_get(&ht, key_of(N_KEYS)));
+
+	/* every other one. */
+	bool del_ok = true;
+	for(int i=0; i < N_KEYS; i += 2) {
+		if(!pht64_del(&ht, key_of(i))) del_ok = false;
+	}
+	ok1(del_ok && !pht64_del(&ht, key_of(0)));
+	ok1(n_found(&ht, 0, N_KEYS) == N_KEYS / 2);
+
+	/* the special keys are multiset members like any other. */
+	pht64_add(&ht, SPECIAL_1);
+	pht64_add(&ht, SPECIAL_1);
+	pht64_add(&ht, SPECIAL_0);
+	ok1(pht64_get(&ht, SPECIAL_1) && pht64_count(&ht) == N_KEYS / 2 + 3);
+	pht64_del(&ht, SPECIAL_1);
+	ok1(pht64_get(&ht, SPECIAL_1) && pht64_del(&ht, SPECIAL_1)
+		&& !pht64_get(&ht, SPECIAL_1));
+
+	/* iteration sees every key once. */
+	uint64_t key, sum = 0, want = SPECIAL_0;
+	size_t seen = 0;
+	struct pht64_iter it;
+	for(bool ok = pht64_first(&ht, &it, &key); ok;
+		ok = pht64_next(&ht, &it, &key))
+	{
+		seen++;
+		sum += key;
+	}
+	for(int i=1; i < N_KEYS; i += 2) want += key_of(i);
+	ok1(seen == pht64_count(&ht));
+	ok1(sum == want);
+
+	pht64_clear(&ht);
+
+	return exit_status();
+}
@@ -0,0 +1,119 @@
+
+/* PHT_MAP: value words through growth and migration, lookups that check a
+ * fingerprint in the value before the key, and changing values in place.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+#define N_STRS 3000
+
+
+static int n_derefs = 0;
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+/* index in the low half of the value word, fingerprint in the high. */
+static uintptr_t val_of(const char *s, int i) {
+	return (uintptr_t)(hash(s, strlen(s), 1) & 0xffff) << 16 | i;
+}
+
+
+static bool cmp_val(const void *cand, uintptr_t val, void *key)
+{
+	if(val >> 16 != val_of(key, 0) >> 16) return false;
+	n_derefs++;
+	return streq(cand, key);
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_str, NULL,
+		&(struct pht_opts){ .flags = PHT_MAP });
+	for(int i=0; i < N_STRS; i++) {
+		pht_add_val(&ht, rehash_str(strs[i], NULL), strs[i],
+			val_of(strs[i], i));
+	}
+	pht_check(&ht, NULL);
+
+	/* with and without migration left to do. */
+	bool vals_ok = true;
+	for(int pass=0; pass < 2; pass++) {
+		for(int i=0; i < N_STRS; i++) {
+			uintptr_t val = 0;
+			if(pht_get_val(&ht, rehash_str(strs[i], NULL), &cmp_val, strs[i],
+				&val) != strs[i] || val != val_of(strs[i], i))
+			{
+				vals_ok = false;
+			}
+		}
+		pht_finish_migration(&ht);
+	}
+	ok1(vals_ok);
+	diag("n_derefs=%d", n_derefs);
+	ok1(n_derefs == N_STRS * 2);
+
+	/* misses rarely get past the fingerprint. */
+	n_derefs = 0;
+	bool miss_ok = true;
+	for(int i=0; i < N_STRS; i++) {
+		char buf[16];
+		snprintf(buf, sizeof buf, "nil%d", i);
+		uintptr_t val;
+		if(pht_get_val(&ht, rehash_str(buf, NULL), &cmp_val, buf, &val)) {
+			miss_ok = false;
+		}
+	}
+	ok1(miss_ok);
+	ok1(n_derefs < N_STRS / 100);
+
+	/* in-place changes through iteration, seen by lookups. */
+	struct pht_iter it;
+	for(char *s = pht_first(&ht, &it); s != NULL; s = pht_next(&ht, &it)) {
+		*pht_iter_val(&ht, &it) |= (uintptr_t)1 << 15;
+	}
+	bool set_ok = true;
+	for(int i=0; i < N_STRS; i++) {
+		uintptr_t val = 0;
+		pht_get_val(&ht, rehash_str(strs[i], NULL), &cmp_val, strs[i], &val);
+		if(val != (val_of(strs[i], i) | (uintptr_t)1 << 15)) set_ok = false;
+	}
+	ok1(set_ok);
+
+	/* and carried over by pht_copy(). */
+	struct pht copy;
+	pht_copy(&copy, &ht);
+	uintptr_t val = 0;
+	ok1(pht_get_val(&copy, rehash_str(strs[7], NULL), &cmp_val, strs[7], &val)
+		== strs[7] && (val & 0x7fff) == 7);
+	pht_clear(&copy);
+
+	pht_clear(&ht);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
@@ -0,0 +1,98 @@
+
+/* PHT_DEFINE_TYPE() over a struct keyed by an integer, with duplicate keys
+ * and enough items for migration.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_ITEMS 3000
+
+
+struct item {
+	int key, serial;
+};
+
+
+static inline int item_key(const struct item *it) {
+	return it->key;
+}
+
+
+static inline size_t hash_int(int key) {
+	return hash(&key, 1, 0);
+}
+
+
+static inline bool item_eq(const struct item *it, int key) {
+	return it->key == key;
+}
+
+
+PHT_DEFINE_TYPE(struct item, item_key, hash_int, item_eq, item_ht);
+
+
+int main(void)
+{
+	plan_tests(7);
+
+	/* every key twice over. */
+	struct item *items = calloc(N_ITEMS * 2, sizeof *items);
+	struct item_ht ht;
+	item_ht_init(&ht);
+	for(int i=0; i < N_ITEMS * 2; i++) {
+		items[i] = (struct item){ .key = i % N_ITEMS, .serial = i };
+		item_ht_add(&ht, &items[i]);
+	}
+	pht_check(&ht.raw, NULL);
+	ok1(item_ht_count(&ht) == N_ITEMS * 2);
+
+	bool get_ok = true;
+	for(int i=0; i < N_ITEMS; i++) {
+		struct item *it = item_ht_get(&ht, i);
+		if(it == NULL || it->key != i
+			|| item_ht_gethash(&ht, hash_int(i), i) == NULL)
+		{
+			get_ok = false;
+		}
+	}
+	ok1(get_ok);
+	ok1(item_ht_get(&ht, N_ITEMS) == NULL);
+
+	/* both of a pair come up through the match iterator. */
+	struct item_ht_iter it;
+	int serials = 0, n = 0;
+	for(struct item *cur = item_ht_getfirst(&ht, 17, &it); cur != NULL;
+		cur = item_ht_getnext(&ht, 17, &it))
+	{
+		serials += cur->serial;
+		n++;
+	}
+	ok1(n == 2 && serials == 17 + 17 + N_ITEMS);
+
+	/* one of each by key, the other by pointer. */
+	bool del_ok = true;
+	for(int i=0; i < N_ITEMS; i++) {
+		if(!item_ht_delkey(&ht, i)) del_ok = false;
+	}
+	ok1(del_ok && item_ht_count(&ht) == N_ITEMS);
+	for(struct item *cur = item_ht_first(&ht, &it); cur != NULL;
+		cur = item_ht_next(&ht, &it))
+	{
+		if(item_ht_get(&ht, cur->key) != cur) del_ok = false;
+	}
+	for(int i=0; i < N_ITEMS * 2; i++) item_ht_del(&ht, &items[i]);
+	ok1(del_ok);
+	ok1(item_ht_count(&ht) == 0 && item_ht_get(&ht, 17) == NULL);
+
+	item_ht_clear(&ht);
+	free(items);
+
+	return exit_status();
+}
@@ -0,0 +1,90 @@
+
+/* PHT_CTRL: growth from classic tables into ones with control bytes,
+ * progressively, and lookups and deletes on both sides of that.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+#include <ccan/str/str.h>
+
+#include "pht.h"
+
+
+/* enough for a table of 64k slots. */
+#define N_STRS 60000
+
+
+static size_t rehash_str(const void *p, void *priv) {
+	return hash(p, strlen(p), (uintptr_t)priv);
+}
+
+
+static bool cmp_str(const void *cand, void *key) {
+	return streq(cand, key);
+}
+
+
+static int n_found(const struct pht *ht, char **strs, int from, int to)
+{
+	int found = 0;
+	for(int i=from; i < to; i++) {
+		if(pht_get(ht, rehash_str(strs[i], NULL), &cmp_str, strs[i])) found++;
+	}
+	return found;
+}
+
+
+int main(void)
+{
+	plan_tests(5);
+
+	char **strs = malloc(sizeof *strs * N_STRS);
+	for(int i=0; i < N_STRS; i++) {
+		strs[i] = malloc(16);
+		snprintf(strs[i], 16, "str%d", i);
+	}
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_str, NULL,
+		&(struct pht_opts){ .flags = PHT_CTRL });
+
+	/* stop at the first growth past 32k items, i.e. into 64k slots, while
+	 * migration out of the classic table is under way.
+	 */
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_str(strs[n], NULL), strs[n]);
+		n++;
+	} while(n < N_STRS && (n < N_STRS / 2 || pht_ntables(&ht) == 1));
+	diag("n=%d", n);
+	ok1(pht_ntables(&ht) > 1);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, strs, 0, n) == n);
+
+	for(int i=n; i < N_STRS; i++) {
+		pht_add(&ht, rehash_str(strs[i], NULL), strs[i]);
+	}
+	pht_finish_migration(&ht);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, strs, 0, N_STRS) == N_STRS);
+
+	/* tombstones and misses. */
+	bool del_ok = true;
+	for(int i=0; i < N_STRS; i += 3) {
+		if(!pht_del(&ht, rehash_str(strs[i], NULL), strs[i])) del_ok = false;
+	}
+	pht_check(&ht, NULL);
+	ok1(del_ok);
+	ok1(n_found(&ht, strs, 0, N_STRS) == N_STRS - (N_STRS + 2) / 3);
+
+	pht_clear(&ht);
+	for(int i=0; i < N_STRS; i++) free(strs[i]);
+	free(strs);
+
+	return exit_status();
+}
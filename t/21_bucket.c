@@ -0,0 +1,114 @@
+/* PHT_BUCKET: items that share a home bucket, more of them than fit, through
+ * growth, deletion, and lookups that overflow into the next bucket. also
+ * that buckets start on a cacheline, in tables from calloc()'s range and from
+ * mmap()'s alike.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 50000
+/* more than a bucket's worth of either wide or compact slots. */
+#define GROUP 20
+
+
+/* items hash in groups so that each group's home bucket overflows. */
+static size_t rehash_int(const void *p, void *priv) {
+	int g = *(const int *)p / GROUP;
+	return hash(&g, 1, 0);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+static int n_found(const struct pht *ht, int *ints, int from, int to)
+{
+	int found = 0;
+	for(int i=from; i < to; i++) {
+		if(pht_get(ht, rehash_int(&ints[i], NULL), &cmp_int, &ints[i])) {
+			found++;
+		}
+	}
+	return found;
+}
+
+
+/* true when the sole item of a table reserved for @room items, which sits
+ * at the start of its home bucket, has its value word at the start of a
+ * cacheline. the value words follow the slots, which come in whole lines, so
+ * that's where the bucket starts as well.
+ */
+static bool bucket_aligned(size_t room)
+{
+	static int one = 1;
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL,
+		&(struct pht_opts){ .flags = PHT_BUCKET | PHT_MAP });
+	pht_reserve(&ht, room);
+	pht_add(&ht, rehash_int(&one, NULL), &one);
+	struct pht_iter it;
+	bool ok = pht_firstval(&ht, &it, rehash_int(&one, NULL)) == &one
+		&& ((uintptr_t)pht_iter_val(&ht, &it) & 63) == 0;
+	pht_clear(&ht);
+	return ok;
+}
+
+
+int main(void)
+{
+	static const size_t rooms[] = { 100, 5000, 200000 };
+	plan_tests(5 + sizeof rooms / sizeof rooms[0]);
+
+	int *ints = malloc(sizeof *ints * N_INTS);
+	for(int i=0; i < N_INTS; i++) ints[i] = i;
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL,
+		&(struct pht_opts){ .flags = PHT_BUCKET });
+
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_int(&ints[n], NULL), &ints[n]);
+		n++;
+	} while(n < N_INTS && (n < N_INTS / 2 || pht_ntables(&ht) == 1));
+	diag("n=%d", n);
+	ok1(pht_ntables(&ht) > 1);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, ints, 0, n) == n);
+
+	for(int i=n; i < N_INTS; i++) {
+		pht_add(&ht, rehash_int(&ints[i], NULL), &ints[i]);
+	}
+	pht_finish_migration(&ht);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, ints, 0, N_INTS) == N_INTS);
+
+	/* tombstones within buckets, and perfect items behind them. */
+	bool del_ok = true;
+	for(int i=0; i < N_INTS; i += 3) {
+		if(!pht_del(&ht, rehash_int(&ints[i], NULL), &ints[i])) {
+			del_ok = false;
+		}
+	}
+	pht_check(&ht, NULL);
+	ok1(del_ok);
+	ok1(n_found(&ht, ints, 0, N_INTS) == N_INTS - (N_INTS + 2) / 3);
+
+	pht_clear(&ht);
+	free(ints);
+
+	for(int i=0; i < sizeof rooms / sizeof rooms[0]; i++) {
+		ok(bucket_aligned(rooms[i]), "room=%zu", rooms[i]);
+	}
+
+	return exit_status();
+}
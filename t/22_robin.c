@@ -0,0 +1,105 @@
+/* PHT_ROBIN_HOOD: clustered items through growth, deletes that shift the
+ * primary's clusters back, and pht_delval() in the middle of a lookup.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 50000
+#define GROUP 5
+
+
+/* items hash in groups so that clusters form. */
+static size_t rehash_int(const void *p, void *priv) {
+	int g = *(const int *)p / GROUP;
+	return hash(&g, 1, 0);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+static int n_found(const struct pht *ht, int *ints, int from, int to)
+{
+	int found = 0;
+	for(int i=from; i < to; i++) {
+		if(pht_get(ht, rehash_int(&ints[i], NULL), &cmp_int, &ints[i])) {
+			found++;
+		}
+	}
+	return found;
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	int *ints = malloc(sizeof *ints * N_INTS);
+	for(int i=0; i < N_INTS; i++) ints[i] = i;
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL,
+		&(struct pht_opts){ .flags = PHT_ROBIN_HOOD });
+
+	int n = 0;
+	do {
+		pht_add(&ht, rehash_int(&ints[n], NULL), &ints[n]);
+		n++;
+	} while(n < N_INTS && (n < N_INTS / 2 || pht_ntables(&ht) == 1));
+	diag("n=%d", n);
+	ok1(pht_ntables(&ht) > 1);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, ints, 0, n) == n);
+
+	for(int i=n; i < N_INTS; i++) {
+		pht_add(&ht, rehash_int(&ints[i], NULL), &ints[i]);
+	}
+	pht_finish_migration(&ht);
+	pht_check(&ht, NULL);
+	ok1(n_found(&ht, ints, 0, N_INTS) == N_INTS);
+
+	bool del_ok = true;
+	for(int i=0; i < N_INTS; i += 3) {
+		if(!pht_del(&ht, rehash_int(&ints[i], NULL), &ints[i])) {
+			del_ok = false;
+		}
+	}
+	pht_check(&ht, NULL);
+	ok1(del_ok);
+	ok1(n_found(&ht, ints, 0, N_INTS) == N_INTS - (N_INTS + 2) / 3);
+
+	/* delete every remaining item of the first few groups by iterating over
+	 * each group's hash, so that each delete shifts the next one back under
+	 * the iterator.
+	 */
+	int seen = 0, want = 0;
+	for(int g=0; g < 100; g++) {
+		for(int i=g * GROUP; i < (g + 1) * GROUP; i++) want += i % 3 != 0;
+		size_t h = rehash_int(&ints[g * GROUP], NULL);
+		struct pht_iter it;
+		for(int *p = pht_firstval(&ht, &it, h); p != NULL;
+			p = pht_nextval(&ht, &it, h))
+		{
+			if(*p / GROUP == g) {
+				pht_delval(&ht, &it);
+				seen++;
+			}
+		}
+	}
+	pht_check(&ht, NULL);
+	ok1(seen == want && n_found(&ht, ints, 0, 100 * GROUP) == 0);
+
+	pht_clear(&ht);
+	free(ints);
+
+	return exit_status();
+}
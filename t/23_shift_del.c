@@ -0,0 +1,108 @@
+/* PHT_SHIFT_DEL: churn at a constant size should neither leave tombstones
+ * nor allocate tables to get rid of them, and lookups through pht_delval()
+ * should see items shifted under the iterator.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 3000
+#define GROUP 5
+
+
+static size_t rehash_int(const void *p, void *priv) {
+	int g = *(const int *)p / GROUP;
+	return hash(&g, 1, 0);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+static void *count_alloc(size_t size, void *priv) {
+	++*(size_t *)priv;
+	void *p;
+	return posix_memalign(&p, 64, size) == 0 ? memset(p, 0, size) : NULL;
+}
+
+
+static void count_free(void *ptr, size_t size, void *priv) {
+	free(ptr);
+}
+
+
+static int n_found(const struct pht *ht, int *ints, int from, int to)
+{
+	int found = 0;
+	for(int i=from; i < to; i++) {
+		if(pht_get(ht, rehash_int(&ints[i], NULL), &cmp_int, &ints[i])) {
+			found++;
+		}
+	}
+	return found;
+}
+
+
+int main(void)
+{
+	plan_tests(4);
+
+	/* a window of N_INTS / 2 items that slides over the array many times. */
+	int *ints = malloc(sizeof *ints * N_INTS);
+	for(int i=0; i < N_INTS; i++) ints[i] = i;
+
+	size_t allocs = 0;
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL, &(struct pht_opts){
+		.flags = PHT_SHIFT_DEL,
+		.alloc = &(struct pht_alloc){ &count_alloc, &count_free, &allocs } });
+	pht_reserve(&ht, N_INTS / 2);
+	for(int i=0; i < N_INTS / 2; i++) {
+		pht_add(&ht, rehash_int(&ints[i], NULL), &ints[i]);
+	}
+	size_t before = allocs;
+	for(int i=0; i < 20 * N_INTS; i++) {
+		int *out = &ints[i % N_INTS], *in = &ints[(i + N_INTS / 2) % N_INTS];
+		pht_del(&ht, rehash_int(out, NULL), out);
+		pht_add(&ht, rehash_int(in, NULL), in);
+	}
+	pht_check(&ht, NULL);
+	diag("allocs=%zu before=%zu", allocs, before);
+	ok1(allocs == before && pht_ntables(&ht) == 1);
+	ok1(n_found(&ht, ints, 0, N_INTS) == N_INTS / 2);
+
+	/* every remaining item of the first few groups, by each group's hash. */
+	int seen = 0, want = 0;
+	for(int g=0; g < 100; g++) {
+		size_t h = rehash_int(&ints[g * GROUP], NULL);
+		for(int i=g * GROUP; i < (g + 1) * GROUP; i++) {
+			if(pht_get(&ht, h, &cmp_int, &ints[i])) want++;
+		}
+		struct pht_iter it;
+		for(int *p = pht_firstval(&ht, &it, h); p != NULL;
+			p = pht_nextval(&ht, &it, h))
+		{
+			if(*p / GROUP == g) {
+				pht_delval(&ht, &it);
+				seen++;
+			}
+		}
+	}
+	pht_check(&ht, NULL);
+	ok1(seen == want);
+	ok1(n_found(&ht, ints, 0, 100 * GROUP) == 0);
+
+	pht_clear(&ht);
+	free(ints);
+
+	return exit_status();
+}
@@ -0,0 +1,97 @@
+/* PHT_PURGE: churn at a constant size, by the default deletion policy,
+ * should keep reusing the one table rather than allocate new ones.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 30000
+
+
+static size_t rehash_int(const void *p, void *priv) {
+	return hash((const int *)p, 1, 0);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+static void *count_alloc(size_t size, void *priv) {
+	++*(size_t *)priv;
+	void *p;
+	return posix_memalign(&p, 64, size) == 0 ? memset(p, 0, size) : NULL;
+}
+
+
+static void count_free(void *ptr, size_t size, void *priv) {
+	free(ptr);
+}
+
+
+/* a window of N_INTS / 3 items that slides over @ints many times, in a
+ * table with room for a little more than that. returns the number of
+ * allocations made while sliding.
+ */
+static size_t churn(struct pht *ht, int *ints, size_t *allocs)
+{
+	pht_reserve(ht, N_INTS / 3);
+	for(int i=0; i < N_INTS / 3; i++) {
+		pht_add(ht, rehash_int(&ints[i], NULL), &ints[i]);
+	}
+	size_t before = *allocs;
+	for(int i=0; i < 10 * N_INTS; i++) {
+		int *out = &ints[i % N_INTS], *in = &ints[(i + N_INTS / 3) % N_INTS];
+		pht_del(ht, rehash_int(out, NULL), out);
+		pht_add(ht, rehash_int(in, NULL), in);
+	}
+	pht_check(ht, NULL);
+	return *allocs - before;
+}
+
+
+int main(void)
+{
+	plan_tests(4);
+
+	int *ints = malloc(sizeof *ints * N_INTS);
+	for(int i=0; i < N_INTS; i++) ints[i] = i;
+
+	/* without purging, tombstones have the table replaced now and then. */
+	size_t allocs = 0;
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL, &(struct pht_opts){
+		.alloc = &(struct pht_alloc){ &count_alloc, &count_free, &allocs } });
+	size_t without = churn(&ht, ints, &allocs);
+	pht_clear(&ht);
+
+	pht_init_opts(&ht, &rehash_int, NULL, &(struct pht_opts){
+		.flags = PHT_PURGE,
+		.alloc = &(struct pht_alloc){ &count_alloc, &count_free, &allocs } });
+	size_t with = churn(&ht, ints, &allocs);
+	diag("without=%zu with=%zu", without, with);
+	ok1(without > 0);
+	ok1(with == 0);
+	ok1(pht_ntables(&ht) == 1);
+
+	bool found = true;
+	for(int i=0; i < N_INTS / 3; i++) {
+		if(!pht_get(&ht, rehash_int(&ints[i], NULL), &cmp_int, &ints[i])) {
+			found = false;
+		}
+	}
+	ok1(found && pht_count(&ht) == N_INTS / 3);
+
+	pht_clear(&ht);
+	free(ints);
+
+	return exit_status();
+}
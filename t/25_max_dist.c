@@ -0,0 +1,170 @@
+/* lookups that end at a table's max_dist: through growth, migration and
+ * deletes, present items should all be found and absent ones not, including
+ * clusters that wrap around the end of a table that's being migrated from.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <ccan/tap/tap.h>
+
+#include "pht.h"
+
+
+#define N_ITEMS 12000
+#define N_ABSENT 2000
+#define GROUP 4
+#define CHECK_EVERY 384
+#define N_SMALL 10000
+#define SMALL 32
+
+
+struct item {
+	size_t hash;
+	bool live;
+};
+
+
+static size_t rehash_item(const void *p, void *priv) {
+	return ((const struct item *)p)->hash;
+}
+
+
+static bool cmp_item(const void *cand, void *key) {
+	return cand == key;
+}
+
+
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+
+/* a hash whose home is in the last 1/64th of any table, as per
+ * t_bucket()'s rotate and xor.
+ */
+static size_t tail_hash(void)
+{
+	const int w = sizeof(size_t) * CHAR_BIT;
+	for(;;) {
+		size_t h = rng(), x = h ^ ((h >> 17) | (h << (w - 17)));
+		if(x >> (w - 6) == (1 << 6) - 1) return h;
+	}
+}
+
+
+/* every sixteenth group of items goes to the end of the table. */
+static size_t group_hash(int g) {
+	return g % 16 == 0 ? tail_hash() : rng();
+}
+
+
+static bool check(const struct pht *ht, struct item *items, int n,
+	struct item *absent, int n_absent)
+{
+	pht_check(ht, NULL);
+	for(int i=0; i < n; i++) {
+		void *p = pht_get(ht, items[i].hash, &cmp_item, &items[i]);
+		if(p != (items[i].live ? &items[i] : NULL)) return false;
+	}
+	for(int i=0; i < n_absent; i++) {
+		if(pht_get(ht, absent[i].hash, &cmp_item, &absent[i]) != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* add items one at a time, deleting every other one of the oldest half as
+ * it goes, and check every so often. returns false when a lookup went
+ * wrong, and counts checks made while there were secondary tables in
+ * *@mid.
+ */
+static bool run(int flags, struct item *items, struct item *absent, int *mid)
+{
+	rng_state = 0x9e3779b97f4a7c15ull;
+	for(int i=0; i < N_ITEMS; i += GROUP) {
+		size_t h = group_hash(i / GROUP);
+		for(int j=i; j < i + GROUP && j < N_ITEMS; j++) {
+			items[j] = (struct item){ .hash = h };
+		}
+	}
+	/* half of the absent items share a hash with present ones. */
+	for(int i=0; i < N_ABSENT; i++) {
+		absent[i].hash = i % 2 == 0 ? items[rng() % N_ITEMS].hash
+			: group_hash(i);
+	}
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_item, NULL,
+		&(struct pht_opts){ .flags = flags });
+	bool ok = true;
+	for(int i=0; i < N_ITEMS && ok; i++) {
+		pht_add(&ht, items[i].hash, &items[i]);
+		items[i].live = true;
+		if(i % 4 == 0) {
+			struct item *victim = &items[i / 2];
+			if(victim->live && !pht_del(&ht, victim->hash, victim)) ok = false;
+			victim->live = false;
+		}
+		if(i % CHECK_EVERY == 0 || i == N_ITEMS - 1) {
+			if(!check(&ht, items, i + 1, absent, N_ABSENT)) ok = false;
+			if(pht_ntables(&ht) > 1) ++*mid;
+		}
+	}
+	pht_clear(&ht);
+	return ok;
+}
+
+
+/* many fresh tables through their first few growths, where fast_migrate()'s
+ * tombstones sometimes leave a table with no empty slot.
+ */
+static bool small_tables(struct item *items)
+{
+	rng_state = 0x2545f4914f6cdd1dull;
+	bool ok = true;
+	for(int r=0; r < N_SMALL && ok; r++) {
+		struct pht ht;
+		pht_init(&ht, &rehash_item, NULL);
+		for(int i=0; i < SMALL * 2; i++) {
+			items[i] = (struct item){ .hash = rng(), .live = i < SMALL };
+			if(i < SMALL) pht_add(&ht, items[i].hash, &items[i]);
+		}
+		ok = check(&ht, items, SMALL, &items[SMALL], SMALL);
+		pht_clear(&ht);
+	}
+	return ok;
+}
+
+
+int main(void)
+{
+	static const int variants[] = {
+		0, PHT_BUCKET, PHT_ROBIN_HOOD, PHT_SHIFT_DEL, PHT_PURGE, PHT_MIG_ON_DEL,
+	};
+	const int n_variants = sizeof variants / sizeof variants[0];
+	plan_tests(n_variants + 2);
+
+	struct item *items = calloc(N_ITEMS, sizeof *items),
+		*absent = calloc(N_ABSENT, sizeof *absent);
+	int mid = 0;
+	for(int i=0; i < n_variants; i++) {
+		ok(run(variants[i], items, absent, &mid), "flags=%#x", variants[i]);
+	}
+	diag("mid=%d", mid);
+	ok1(mid > 0);
+	ok1(small_tables(items));
+
+	free(items);
+	free(absent);
+
+	return exit_status();
+}
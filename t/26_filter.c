@@ -0,0 +1,135 @@
+/* PHT_FILTER: lookups stay correct while secondaries' filters are built and
+ * used, and most misses rule the secondary out up front once it's built,
+ * whether the table was filled by pht_add() or pht_add_many().
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 50000
+#define BATCH 16
+
+
+static size_t rehash_int(const void *p, void *priv) {
+	return hash((const int *)p, 1, 0);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+static void add(struct pht *ht, int *ints, int i, bool many)
+{
+	if(!many) {
+		pht_add(ht, rehash_int(&ints[i], NULL), &ints[i]);
+		return;
+	}
+	size_t hashes[BATCH];
+	const void *ptrs[BATCH];
+	for(int k=0; k < BATCH; k++) {
+		hashes[k] = rehash_int(&ints[i + k], NULL);
+		ptrs[k] = &ints[i + k];
+	}
+	pht_add_many(ht, BATCH, hashes, ptrs);
+}
+
+
+/* grow a table of @flags by one step, by pht_add() or pht_add_many(), keep
+ * adding until the secondary's filter has surely been built, then count the
+ * misses that rule it out.
+ */
+static int skipping_misses(int *ints, int flags, bool many, bool *two)
+{
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL,
+		&(struct pht_opts){ .flags = flags });
+	int i = 0, step = many ? BATCH : 1;
+	for(; i < N_INTS / 2; i += step) add(&ht, ints, i, many);
+	pht_finish_migration(&ht);
+	/* keep adding until there's been exactly one secondary for 2048 adds;
+	 * one add builds FILTER_STEP = 64 slots of its filter. (a change in the
+	 * common bits may replace the primary along the way.)
+	 */
+	size_t nt = pht_ntables(&ht);
+	int since = 0;
+	while((nt != 2 || since < 2048) && i < 2 * N_INTS - 1000 - BATCH) {
+		add(&ht, ints, i, many);
+		i += step;
+		since += step;
+		if(pht_ntables(&ht) != nt) {
+			nt = pht_ntables(&ht);
+			since = 0;
+		}
+	}
+	*two = nt == 2 && since >= 2048;
+
+	int skipping = 0;
+	for(int j = 2 * N_INTS - 1000; j < 2 * N_INTS; j++) {
+		if(pht_ntables_for(&ht, rehash_int(&ints[j], NULL)) < nt) skipping++;
+	}
+
+	pht_clear(&ht);
+	return skipping;
+}
+
+
+int main(void)
+{
+	plan_tests(6);
+
+	/* within one aligned megabyte, so that where malloc() puts it can't change
+	 * the common bits and with them when tables are replaced.
+	 */
+	int *ints = aligned_alloc(1 << 20, 1 << 20);
+	for(int i=0; i < 2 * N_INTS; i++) ints[i] = i;
+
+	struct pht ht;
+	pht_init_opts(&ht, &rehash_int, NULL,
+		&(struct pht_opts){ .flags = PHT_FILTER });
+	bool found = true, missed = true, grew = false;
+	for(int i=0; i < N_INTS; i++) {
+		pht_add(&ht, rehash_int(&ints[i], NULL), &ints[i]);
+		if(pht_ntables(&ht) > 1) grew = true;
+		if(i % 97 != 0) continue;
+
+		for(int j = 0; j <= i; j += 7) {
+			if(!pht_get(&ht, rehash_int(&ints[j], NULL), &cmp_int, &ints[j])) {
+				found = false;
+			}
+		}
+		for(int j = N_INTS; j < N_INTS + 500; j++) {
+			if(pht_get(&ht, rehash_int(&ints[j], NULL), &cmp_int, &ints[j])) {
+				missed = false;
+			}
+		}
+		pht_check(&ht, NULL);
+	}
+	ok1(grew);
+	ok1(found);
+	ok1(missed);
+	pht_clear(&ht);
+
+	bool two_with, two_many, two_without;
+	int with = skipping_misses(ints, PHT_FILTER, false, &two_with),
+		many = skipping_misses(ints, PHT_FILTER, true, &two_many),
+		without = skipping_misses(ints, 0, false, &two_without);
+	/* without the filter, only misses whose probe starts in what's already
+	 * been migrated skip the secondary.
+	 */
+	diag("skipping misses with=%d many=%d without=%d", with, many, without);
+	ok1(two_with && two_many && two_without);
+	ok1(with > 2 * without);
+	ok1(many > 2 * without);
+
+	free(ints);
+
+	return exit_status();
+}
@@ -0,0 +1,80 @@
+/* PHT_STORE_HASH: growth, migration, Robin Hood insertion, shift deletion
+ * and pht_check() shouldn't call rehash at all. neither should
+ * PHT_ROBIN_HOOD, PHT_SHIFT_DEL or PHT_PURGE, which imply it.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ccan/tap/tap.h>
+#include <ccan/hash/hash.h>
+
+#include "pht.h"
+
+
+#define N_INTS 50000
+
+
+static size_t hash_int(const int *p) {
+	return hash(p, 1, 0);
+}
+
+
+static size_t n_rehash;
+
+
+static size_t rehash_int(const void *p, void *priv) {
+	n_rehash++;
+	return hash_int(p);
+}
+
+
+static bool cmp_int(const void *cand, void *key) {
+	return *(const int *)cand == *(int *)key;
+}
+
+
+int main(void)
+{
+	static const unsigned flags[] = {
+		PHT_STORE_HASH,
+		PHT_MAP | PHT_SHIFT_DEL,
+		PHT_ROBIN_HOOD,
+		PHT_PURGE,
+		PHT_STORE_HASH | PHT_CONCURRENT_READ,
+	};
+	const int n_flags = sizeof flags / sizeof flags[0];
+	plan_tests(2 * n_flags);
+
+	int *ints = malloc(sizeof *ints * N_INTS);
+	for(int i=0; i < N_INTS; i++) ints[i] = i;
+
+	for(int f=0; f < n_flags; f++) {
+		struct pht ht;
+		pht_init_opts(&ht, &rehash_int, NULL,
+			&(struct pht_opts){ .flags = flags[f] });
+		n_rehash = 0;
+		for(int i=0; i < N_INTS; i++) {
+			pht_add(&ht, hash_int(&ints[i]), &ints[i]);
+			if(i % 3 == 0) pht_del(&ht, hash_int(&ints[i / 3]), &ints[i / 3]);
+			if(i % 5000 == 0) pht_check(&ht, NULL);
+		}
+		pht_check(&ht, NULL);
+		diag("flags=%#x n_rehash=%zu", flags[f], n_rehash);
+		ok1(n_rehash == 0);
+
+		/* the first third was deleted along the way. */
+		bool found = true;
+		for(int i=0; i < N_INTS; i++) {
+			bool del = i * 3 < N_INTS;
+			void *p = pht_get(&ht, hash_int(&ints[i]), &cmp_int, &ints[i]);
+			if((p != NULL) == del) found = false;
+		}
+		ok1(found && pht_count(&ht) == N_INTS - (N_INTS + 2) / 3);
+		pht_clear(&ht);
+	}
+
+	free(ints);
+
+	return exit_status();
+}